@@ -0,0 +1,61 @@
+#include <algorithm>
+#include <iterator>
+
+#include <fc/exception/exception.hpp>
+#include <fc/log/logger.hpp>
+
+#include "account_upsert_lane.hpp"
+
+namespace eosio {
+
+account_upsert_lane::account_upsert_lane(size_t max_queued, writer write):
+   max_queued(max_queued ? max_queued : 1), write(std::move(write))
+{
+   thread = std::thread( [this]() { run(); } );
+}
+
+account_upsert_lane::~account_upsert_lane() {
+   {
+      std::lock_guard<std::mutex> guard(mtx);
+      done = true;
+   }
+   queue_cv.notify_one();
+   thread.join();
+}
+
+void account_upsert_lane::push( account_upserts&& upserts ) {
+   {
+      std::unique_lock<std::mutex> lock(mtx);
+      space_cv.wait( lock, [this]() { return queue.size() < max_queued; } );
+      queue.emplace_back( std::move(upserts) );
+   }
+   queue_cv.notify_one();
+}
+
+void account_upsert_lane::run() {
+   std::vector<account_upserts> batch;
+   while ( true ) {
+      {
+         std::unique_lock<std::mutex> lock(mtx);
+         queue_cv.wait( lock, [this]() { return done || !queue.empty(); } );
+         if ( queue.empty() ) break;
+         batch.reserve( queue.size() );
+         std::move( queue.begin(), queue.end(), std::back_inserter(batch) );
+         queue.clear();
+      }
+      space_cv.notify_all();
+
+      try {
+         write( batch );
+      } catch ( const fc::exception& e ) {
+         elog("account upsert lane: ${e}", ("e", e.to_detail_string()));
+      } catch ( const std::exception& e ) {
+         elog("account upsert lane: ${e}", ("e", e.what()));
+      } catch ( ... ) {
+         elog("account upsert lane: unknown exception");
+      }
+      batch.clear();
+   }
+}
+
+}
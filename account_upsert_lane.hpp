@@ -0,0 +1,59 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fc/variant_object.hpp>
+
+#include "memory_budget.hpp"
+
+namespace eosio {
+
+/// account upserts of one transaction: painless script and params by account name
+struct account_upserts {
+   uint32_t block_num = 0;
+   std::unordered_map<uint64_t, std::pair<std::string, fc::mutable_variant_object>> actions;
+   memory_credit_ptr credit; ///< held until the upserts are written
+};
+
+/**
+ *  Single writer of the accounts index. Upserts are queued in chain order and
+ *  written by one thread, which sends everything queued since its last write in
+ *  one bulk request. Elasticsearch applies the items of a bulk in order, so the
+ *  updates of an account land in chain order without holding worker threads
+ *  on a lock.
+ */
+class account_upsert_lane
+{
+public:
+   /// writes the batches in order, called on the lane thread only
+   using writer = std::function<void( std::vector<account_upserts>& )>;
+
+   /// @param max_queued transactions that may wait for the writer before push blocks
+   account_upsert_lane(size_t max_queued, writer write);
+   /// writes the remaining upserts before the thread is joined
+   ~account_upsert_lane();
+
+   /// blocks while max_queued transactions are waiting
+   void push( account_upserts&& upserts );
+
+private:
+   void run();
+
+   const size_t max_queued;
+   writer write;
+
+   std::deque<account_upserts> queue;
+   bool done = false;
+   std::mutex mtx;
+   std::condition_variable queue_cv;
+   std::condition_variable space_cv;
+   std::thread thread;
+};
+
+}
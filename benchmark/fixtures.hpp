@@ -0,0 +1,157 @@
+#pragma once
+#include <eosio/chain/abi_def.hpp>
+#include <eosio/chain/asset.hpp>
+#include <eosio/chain/block_state.hpp>
+#include <eosio/chain/trace.hpp>
+#include <eosio/chain/transaction.hpp>
+
+#include <fc/io/raw.hpp>
+
+namespace eosio { namespace benchmark {
+
+struct transfer {
+   chain::name    from;
+   chain::name    to;
+   chain::asset   quantity;
+   std::string    memo;
+};
+
+} }
+
+FC_REFLECT( eosio::benchmark::transfer, (from)(to)(quantity)(memo) )
+
+namespace eosio { namespace benchmark {
+
+inline chain::abi_def token_abi() {
+   chain::abi_def abi;
+   abi.version = "eosio::abi/1.0";
+   abi.structs.emplace_back( chain::struct_def{ "transfer", "", {
+      {"from", "name"}, {"to", "name"}, {"quantity", "asset"}, {"memo", "string"} } } );
+   abi.actions.emplace_back( chain::action_def{ N(transfer), "transfer", "" } );
+   return abi;
+}
+
+/**
+ *  Deterministic synthetic chain data: every block carries the same number of
+ *  transactions, each made of eosio.token transfers between a fixed set of
+ *  accounts, with matching traces and block states. Blocks competing with the
+ *  chain can be made to exercise fork handling.
+ */
+class fixture_builder
+{
+public:
+   struct block_fixture {
+      chain::block_state_ptr                      block_state;
+      std::vector<chain::transaction_trace_ptr>   traces;
+   };
+
+   fixture_builder( uint32_t trxs_per_block, uint32_t actions_per_trx )
+      :trxs_per_block(trxs_per_block), actions_per_trx(actions_per_trx) {}
+
+   chain::action make_transfer( uint64_t n ) const {
+      static const std::vector<chain::name> accounts = {
+         N(alice), N(bob), N(carol), N(dave), N(eosio.ram), N(eosio.stake), N(eosio.saving), N(exchange)
+      };
+      transfer t;
+      t.from = accounts[n % accounts.size()];
+      t.to = accounts[(n * 7 + 3) % accounts.size()];
+      t.quantity = chain::asset( static_cast<int64_t>(n % 1000000 + 1), chain::symbol(4, "EOS") );
+      t.memo = "benchmark transfer " + std::to_string(n);
+
+      return chain::action( std::vector<chain::permission_level>{{t.from, chain::config::active_name}},
+                            N(eosio.token), N(transfer), fc::raw::pack(t) );
+   }
+
+   block_fixture next_block() {
+      const uint32_t block_num = ++last_block_num;
+      fork_previous = previous;
+      auto fixture = make_block( block_num, N(eosio), previous );
+      previous = fixture.block_state->id;
+      return fixture;
+   }
+
+   /// a block competing with the last one of next_block, it is never part of the current chain
+   block_fixture fork_block() {
+      auto fixture = make_block( last_block_num, N(forker), fork_previous );
+      fixture.block_state->in_current_chain = false;
+      return fixture;
+   }
+
+private:
+   block_fixture make_block( uint32_t block_num, chain::name producer, const chain::block_id_type& parent ) {
+      block_fixture fixture;
+
+      auto block = std::make_shared<chain::signed_block>();
+      block->timestamp = chain::block_timestamp_type( fc::time_point_sec(1560000000) );
+      block->timestamp.slot += block_num;
+      block->producer = producer;
+      block->previous = parent;
+
+      std::vector<std::pair<chain::transaction_id_type, std::vector<chain::action>>> trxs;
+      for( uint32_t i = 0; i < trxs_per_block; ++i ) {
+         chain::signed_transaction trx;
+         trx.expiration = fc::time_point_sec( block->timestamp.to_time_point() ) + 30;
+         trx.ref_block_num = static_cast<uint16_t>(block_num - 1);
+         for( uint32_t j = 0; j < actions_per_trx; ++j ) {
+            trx.actions.emplace_back( make_transfer( ++action_count ) );
+         }
+         trxs.emplace_back( trx.id(), trx.actions );
+         block->transactions.emplace_back( chain::packed_transaction( std::move(trx) ) );
+      }
+
+      // the block id hashes the header only, so it is final once the header fields are set
+      const auto block_id = block->id();
+
+      for( auto& trx : trxs ) {
+         auto trace = std::make_shared<chain::transaction_trace>();
+         trace->id = trx.first;
+         trace->block_num = block_num;
+         trace->block_time = block->timestamp;
+         trace->producer_block_id = block_id;
+         trace->receipt = chain::transaction_receipt_header( chain::transaction_receipt_header::executed );
+         trace->elapsed = fc::microseconds( 200 );
+         trace->net_usage = 128;
+
+         for( auto& act : trx.second ) {
+            chain::action_receipt receipt;
+            receipt.receiver = act.account;
+            receipt.act_digest = chain::digest_type::hash( act );
+            receipt.global_sequence = ++global_sequence;
+            receipt.recv_sequence = global_sequence;
+            receipt.auth_sequence[act.authorization[0].actor] = global_sequence;
+
+            chain::action_trace atrace( receipt );
+            atrace.act = act;
+            atrace.elapsed = fc::microseconds( 50 );
+            atrace.trx_id = trx.first;
+            atrace.block_num = block_num;
+            atrace.block_time = block->timestamp;
+            atrace.producer_block_id = block_id;
+            trace->action_traces.emplace_back( std::move(atrace) );
+         }
+         fixture.traces.emplace_back( std::move(trace) );
+      }
+
+      auto bs = std::make_shared<chain::block_state>();
+      bs->id = block_id;
+      bs->block_num = block_num;
+      bs->header = *block;
+      bs->block = block;
+      bs->validated = true;
+      bs->in_current_chain = true;
+      fixture.block_state = std::move(bs);
+
+      return fixture;
+   }
+
+   uint32_t trxs_per_block;
+   uint32_t actions_per_trx;
+
+   uint32_t last_block_num = 1;
+   uint64_t action_count = 0;
+   uint64_t global_sequence = 0;
+   chain::block_id_type previous;
+   chain::block_id_type fork_previous;
+};
+
+} }
@@ -0,0 +1,156 @@
+/**
+ *  Micro-benchmarks of the per-document hot paths of elasticsearch_plugin.
+ */
+#include <benchmark/benchmark.h>
+
+#include <fc/filesystem.hpp>
+#include <fc/io/json.hpp>
+#include <fc/utf8.hpp>
+
+#include "elasticsearch_plugin_impl.hpp"
+#include "json_writer.hpp"
+#include "mock_elasticsearch.hpp"
+#include "fixtures.hpp"
+
+using eosio::elasticsearch_plugin_impl;
+using eosio::filter_entry;
+using eosio::bulker;
+
+namespace chain = eosio::chain;
+namespace fixtures = eosio::benchmark;
+
+namespace {
+
+/// shared state, created once for all benchmarks
+struct environment {
+   fc::temp_directory abi_dir;
+   fixtures::mock_elasticsearch es;
+   std::unique_ptr<::serializer> abi_serializer;
+
+   environment() {
+      abi_serializer.reset( new ::serializer(abi_dir.path(), fc::microseconds::maximum(), 64*1024*1024ll) );
+      abi_serializer->upsert_abi_cache( N(eosio.token), fixtures::token_abi() );
+   }
+
+   static environment& get() {
+      static environment env;
+      return env;
+   }
+};
+
+chain::transaction_trace_ptr make_trace( uint32_t actions ) {
+   fixtures::fixture_builder builder( 1, actions );
+   return builder.next_block().traces.front();
+}
+
+void BM_serializer_transfer_action_trace( benchmark::State& state ) {
+   auto& env = environment::get();
+   auto trace = make_trace( 1 );
+   const chain::base_action_trace& base = trace->action_traces.front();
+
+   for( auto _ : state ) {
+      benchmark::DoNotOptimize( env.abi_serializer->to_variant_with_abi( base ) );
+   }
+}
+BENCHMARK( BM_serializer_transfer_action_trace );
+
+void BM_serializer_transaction_trace( benchmark::State& state ) {
+   auto& env = environment::get();
+   auto trace = make_trace( state.range(0) );
+
+   for( auto _ : state ) {
+      benchmark::DoNotOptimize( env.abi_serializer->to_variant_with_abi( *trace ) );
+   }
+   state.SetItemsProcessed( state.iterations() * state.range(0) );
+}
+BENCHMARK( BM_serializer_transaction_trace )->Arg(1)->Arg(10)->Arg(100)->Arg(1000);
+
+/// a decoded transaction trace with a memo carrying invalid UTF-8, as spam memos on mainnet do
+fc::variant make_trace_variant( uint32_t actions ) {
+   auto trace = make_trace( actions );
+   auto v = environment::get().abi_serializer->to_variant_with_abi( *trace );
+   fc::mutable_variant_object doc( v.get_object() );
+   doc( "memo", std::string( "airdrop \xF0\x9F\x8E\x81 claim at \"example\" \xC0\xAF\xED\xA0\x80 now\n" ) + std::string( 200, 'x' ) );
+   return fc::variant( doc );
+}
+
+void BM_document_json_fc( benchmark::State& state ) {
+   auto v = make_trace_variant( state.range(0) );
+
+   for( auto _ : state ) {
+      benchmark::DoNotOptimize( fc::prune_invalid_utf8( fc::json::to_string( v ) ) );
+   }
+   state.SetBytesProcessed( state.iterations() * eosio::to_json( v ).size() );
+}
+BENCHMARK( BM_document_json_fc )->Arg(1)->Arg(10)->Arg(100);
+
+void BM_document_json( benchmark::State& state ) {
+   auto v = make_trace_variant( state.range(0) );
+
+   for( auto _ : state ) {
+      benchmark::DoNotOptimize( eosio::to_json( v ) );
+   }
+   state.SetBytesProcessed( state.iterations() * eosio::to_json( v ).size() );
+}
+BENCHMARK( BM_document_json )->Arg(1)->Arg(10)->Arg(100);
+
+void BM_filter_include( benchmark::State& state ) {
+   elasticsearch_plugin_impl impl;
+   impl.filter.on_star = false;
+   for( int64_t i = 0; i < state.range(0); ++i ) {
+      // none of the entries match, so every entry is visited
+      filter_entry fe{ chain::name( 1000 + i ), N(transfer), chain::name() };
+      impl.filter.on.insert( fe );
+   }
+   impl.filter.out.insert( filter_entry{ N(eosio), N(onblock), chain::name() } );
+
+   std::vector<chain::permission_level> authorization{ {N(alice), N(active)}, {N(bob), N(active)} };
+
+   for( auto _ : state ) {
+      benchmark::DoNotOptimize( impl.filter_include( N(eosio.token), N(transfer), authorization ) );
+   }
+}
+BENCHMARK( BM_filter_include )->Arg(10)->Arg(100)->Arg(1000);
+
+void BM_bulker_append_document( benchmark::State& state ) {
+   auto& env = environment::get();
+   static std::unique_ptr<bulker> bulk;
+   if( state.thread_index == 0 ) {
+      bulk.reset( new bulker(5 * 1024 * 1024, std::vector<std::string>({ env.es.url() }), "", "") );
+   }
+
+   const std::string action = "{\"index\":{\"_index\":\"action_traces\",\"_type\":\"_doc\",\"_id\":1730634}}";
+   const std::string source( 512, 'x' );
+
+   for( auto _ : state ) {
+      bulk->append_document( action, source );
+   }
+   state.SetBytesProcessed( state.iterations() * (action.size() + source.size() + 2) );
+
+   if( state.thread_index == 0 ) {
+      bulk.reset();
+   }
+}
+BENCHMARK( BM_bulker_append_document )->ThreadRange(1, 8)->UseRealTime();
+
+void BM_accepted_block_json( benchmark::State& state ) {
+   auto& env = environment::get();
+   fixtures::fixture_builder builder( state.range(0), 4 );
+   auto bs = builder.next_block().block_state;
+
+   elasticsearch_plugin_impl impl;
+   impl.serializer.swap( env.abi_serializer );
+
+   for( auto _ : state ) {
+      auto docs = impl.make_block_docs( bs );
+      benchmark::DoNotOptimize( impl.accepted_block_state_source( *docs, bs ) );
+      benchmark::DoNotOptimize( impl.accepted_block_source( *docs ) );
+   }
+
+   impl.serializer.swap( env.abi_serializer );
+}
+BENCHMARK( BM_accepted_block_json )->Arg(0)->Arg(20)->Arg(200);
+
+}
+
+BENCHMARK_MAIN();
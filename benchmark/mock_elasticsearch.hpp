@@ -0,0 +1,174 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/algorithm/string.hpp>
+
+namespace eosio { namespace benchmark {
+
+/**
+ *  In-process stand-in for an elasticsearch node. It accepts keep-alive HTTP/1.1
+ *  connections on a loopback port, answers index management requests with 200
+ *  and acknowledges every `_bulk` request with `"errors": false`, so the plugin
+ *  pipeline can be measured without a cluster on the other side.
+ */
+class mock_elasticsearch
+{
+public:
+   using bulk_handler = std::function<void(const std::string& body)>;
+   /// called with the path and the query of `_delete_by_query` and `_update_by_query` requests
+   using by_query_handler = std::function<void(const std::string& path, const std::string& body)>;
+
+   explicit mock_elasticsearch( bulk_handler on_bulk = bulk_handler(), by_query_handler on_by_query = by_query_handler() )
+      :acceptor(io, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)),
+       on_bulk(std::move(on_bulk)), on_by_query(std::move(on_by_query))
+   {
+      accept_thread = std::thread([this] { accept_loop(); });
+   }
+
+   ~mock_elasticsearch() {
+      done = true;
+      boost::system::error_code ec;
+      {
+         // wake up the blocking accept
+         boost::asio::ip::tcp::socket wakeup(io);
+         wakeup.connect(acceptor.local_endpoint(), ec);
+      }
+      if( accept_thread.joinable() ) accept_thread.join();
+      acceptor.close(ec);
+
+      std::lock_guard<std::mutex> guard(mtx);
+      for( auto& s : sockets ) {
+         s->shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+         s->close(ec);
+      }
+      for( auto& t : connection_threads ) {
+         if( t.joinable() ) t.join();
+      }
+   }
+
+   std::string url() const {
+      return "http://127.0.0.1:" + std::to_string(acceptor.local_endpoint().port()) + "/";
+   }
+
+   uint64_t bulk_requests() const { return bulk_count; }
+   uint64_t bulk_bytes() const { return bulk_body_bytes; }
+   uint64_t bulk_documents() const { return bulk_docs; }
+
+   /// marks the calling thread as part of the mock, e.g. to keep it out of allocation counters
+   static bool& mock_thread() {
+      static thread_local bool is_mock = false;
+      return is_mock;
+   }
+
+private:
+   using socket_ptr = std::shared_ptr<boost::asio::ip::tcp::socket>;
+
+   void accept_loop() {
+      mock_thread() = true;
+      while( !done ) {
+         auto socket = std::make_shared<boost::asio::ip::tcp::socket>(io);
+         boost::system::error_code ec;
+         acceptor.accept(*socket, ec);
+         if( ec || done ) break;
+
+         std::lock_guard<std::mutex> guard(mtx);
+         sockets.push_back(socket);
+         connection_threads.emplace_back([this, socket] { serve(socket); });
+      }
+   }
+
+   void serve( socket_ptr socket ) {
+      mock_thread() = true;
+      boost::asio::streambuf buf;
+      boost::system::error_code ec;
+
+      while( !done ) {
+         auto header_size = boost::asio::read_until(*socket, buf, "\r\n\r\n", ec);
+         if( ec ) return;
+
+         std::string header( boost::asio::buffers_begin(buf.data()),
+                             boost::asio::buffers_begin(buf.data()) + header_size );
+         buf.consume(header_size);
+
+         std::vector<std::string> lines;
+         boost::split( lines, header, boost::is_any_of("\n") );
+         std::vector<std::string> request_line;
+         boost::split( request_line, lines[0], boost::is_any_of(" ") );
+         if( request_line.size() < 2 ) return;
+         const auto& method = request_line[0];
+         const auto& path = request_line[1];
+
+         size_t content_length = 0;
+         bool expect_continue = false;
+         for( auto& l : lines ) {
+            boost::trim( l );
+            auto lower = boost::to_lower_copy( l );
+            if( boost::starts_with( lower, "content-length:" ) ) {
+               content_length = std::stoull( boost::trim_copy( l.substr(15) ) );
+            } else if( boost::starts_with( lower, "expect:" ) && lower.find("100-continue") != std::string::npos ) {
+               expect_continue = true;
+            }
+         }
+
+         if( expect_continue ) {
+            boost::asio::write(*socket, boost::asio::buffer(std::string("HTTP/1.1 100 Continue\r\n\r\n")), ec);
+            if( ec ) return;
+         }
+
+         if( buf.size() < content_length ) {
+            boost::asio::read(*socket, buf, boost::asio::transfer_exactly(content_length - buf.size()), ec);
+            if( ec ) return;
+         }
+         std::string body( boost::asio::buffers_begin(buf.data()),
+                           boost::asio::buffers_begin(buf.data()) + content_length );
+         buf.consume(content_length);
+
+         std::string response_body;
+         if( path.find("_bulk") != std::string::npos ) {
+            ++bulk_count;
+            bulk_body_bytes += body.size();
+            bulk_docs += std::count( body.begin(), body.end(), '\n' ) / 2;
+            if( on_bulk ) on_bulk( body );
+            response_body = "{\"took\":1,\"errors\":false,\"items\":[]}";
+         } else if( path.find("_by_query") != std::string::npos ) {
+            if( on_by_query ) on_by_query( path, body );
+            response_body = "{\"took\":1,\"deleted\":0,\"updated\":0,\"failures\":[]}";
+         } else if( path.find("_count") != std::string::npos ) {
+            response_body = "{\"count\":1}";
+         } else if( method != "HEAD" ) {
+            response_body = "{\"acknowledged\":true}";
+         }
+
+         std::string response = "HTTP/1.1 200 OK\r\n"
+                                "Content-Type: application/json\r\n"
+                                "Content-Length: " + std::to_string(response_body.size()) + "\r\n\r\n";
+         if( method != "HEAD" ) response += response_body;
+         boost::asio::write(*socket, boost::asio::buffer(response), ec);
+         if( ec ) return;
+      }
+   }
+
+   boost::asio::io_service io;
+   boost::asio::ip::tcp::acceptor acceptor;
+   bulk_handler on_bulk;
+   by_query_handler on_by_query;
+
+   std::atomic<bool> done{false};
+   std::thread accept_thread;
+   std::vector<socket_ptr> sockets;
+   std::vector<std::thread> connection_threads;
+   std::mutex mtx;
+
+   std::atomic<uint64_t> bulk_count{0};
+   std::atomic<uint64_t> bulk_body_bytes{0};
+   std::atomic<uint64_t> bulk_docs{0};
+};
+
+} }
@@ -0,0 +1,312 @@
+/**
+ *  End-to-end benchmark of the elasticsearch_plugin pipeline.
+ *
+ *  Synthetic blocks and traces are fed through the plugin's signal handlers,
+ *  processed by the consume thread, thread pool and bulkers, and delivered to an
+ *  in-process mock `_bulk` endpoint. The run is deterministic for a given set of
+ *  options, so numbers are comparable between builds.
+ */
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+
+#include <fc/filesystem.hpp>
+
+#include "elasticsearch_plugin_impl.hpp"
+#include "mock_elasticsearch.hpp"
+#include "fixtures.hpp"
+
+namespace bpo = boost::program_options;
+
+using eosio::benchmark::mock_elasticsearch;
+
+namespace {
+
+std::atomic<bool> count_allocations{false};
+std::atomic<uint64_t> allocations{0};
+thread_local bool untracked = false;
+
+/// keeps the benchmark's own bookkeeping out of the allocation count
+struct untracked_scope {
+   untracked_scope() { untracked = true; }
+   ~untracked_scope() { untracked = false; }
+};
+
+using clock_type = std::chrono::steady_clock;
+
+/// per stage latency samples in microseconds
+class latency_recorder
+{
+public:
+   void submitted( const std::string& id ) {
+      std::lock_guard<std::mutex> guard(mtx);
+      pending.emplace( id, clock_type::now() );
+   }
+
+   void sample( const std::string& stage, clock_type::duration d ) {
+      std::lock_guard<std::mutex> guard(mtx);
+      samples[stage].push_back( std::chrono::duration_cast<std::chrono::microseconds>(d).count() );
+   }
+
+   /// records the delivery latency of every document seen for the first time in a bulk body
+   void delivered( const std::string& body ) {
+      auto now = clock_type::now();
+      size_t pos = 0;
+      bool action_line = true;
+      while( pos < body.size() ) {
+         auto end = body.find( '\n', pos );
+         if( end == std::string::npos ) end = body.size();
+         if( action_line ) {
+            auto index = field( body, pos, end, "\"_index\":" );
+            auto id = field( body, pos, end, "\"_id\":" );
+            std::lock_guard<std::mutex> guard(mtx);
+            auto it = pending.find( id );
+            if( it != pending.end() ) {
+               samples["deliver " + index].push_back(
+                  std::chrono::duration_cast<std::chrono::microseconds>(now - it->second).count() );
+               pending.erase( it );
+            }
+         }
+         action_line = !action_line;
+         pos = end + 1;
+      }
+   }
+
+   void report() {
+      std::lock_guard<std::mutex> guard(mtx);
+      std::printf( "%-36s %10s %10s %10s\n", "stage latency (us)", "count", "p50", "p99" );
+      for( auto& s : samples ) {
+         auto& v = s.second;
+         std::sort( v.begin(), v.end() );
+         std::printf( "%-36s %10zu %10lld %10lld\n", s.first.c_str(), v.size(),
+                      static_cast<long long>(percentile(v, 0.50)), static_cast<long long>(percentile(v, 0.99)) );
+      }
+   }
+
+private:
+   static std::string field( const std::string& body, size_t begin, size_t end, const char* key ) {
+      auto pos = body.find( key, begin );
+      if( pos == std::string::npos || pos >= end ) return std::string();
+      pos += std::strlen( key );
+      if( body[pos] == '"' ) ++pos;
+      auto stop = body.find_first_of( "\",}", pos );
+      return body.substr( pos, std::min(stop, end) - pos );
+   }
+
+   static int64_t percentile( const std::vector<int64_t>& sorted, double p ) {
+      if( sorted.empty() ) return 0;
+      return sorted[ std::min( sorted.size() - 1, static_cast<size_t>(p * sorted.size()) ) ];
+   }
+
+   std::unordered_map<std::string, clock_type::time_point> pending;
+   std::map<std::string, std::vector<int64_t>> samples;
+   std::mutex mtx;
+};
+
+}
+
+void* operator new( std::size_t n ) {
+   if( count_allocations && !untracked && !mock_elasticsearch::mock_thread() ) ++allocations;
+   void* p = std::malloc( n ? n : 1 );
+   if( !p ) throw std::bad_alloc();
+   return p;
+}
+
+void operator delete( void* p ) noexcept {
+   std::free( p );
+}
+
+void operator delete( void* p, std::size_t ) noexcept {
+   std::free( p );
+}
+
+int main( int argc, char** argv ) {
+   try {
+      bpo::options_description desc("elasticsearch_plugin pipeline benchmark options");
+      desc.add_options()
+         ("help,h", "Print this help message and exit.")
+         ("blocks", bpo::value<uint32_t>()->default_value(2000), "The number of blocks to feed.")
+         ("trxs-per-block", bpo::value<uint32_t>()->default_value(20), "The number of transactions in each block.")
+         ("actions-per-trx", bpo::value<uint32_t>()->default_value(4), "The number of transfer actions in each transaction.")
+         ("irreversible-lag", bpo::value<uint32_t>()->default_value(330), "The number of blocks a block stays reversible.")
+         ("fork-every", bpo::value<uint32_t>()->default_value(0),
+          "Feed a competing block after every n-th block and delete its documents once the other one is irreversible, 0 to feed no forks. "
+          "The run fails if documents of a cleaned up block are sent after its cleanup.")
+         ("elastic-memory-budget-mb", bpo::value<size_t>()->default_value(512), "The memory budget(megabytes) of the plugin.")
+         ("elastic-thread-pool-size", bpo::value<size_t>()->default_value(4), "The size of the data processing thread pool.")
+         ("elastic-bulk-size-mb", bpo::value<size_t>()->default_value(5), "The size(megabytes) of the each bulk request.")
+         ;
+
+      bpo::variables_map options;
+      bpo::store( bpo::parse_command_line(argc, argv, desc), options );
+      bpo::notify( options );
+
+      if( options.count( "help" ) ) {
+         std::cout << desc << std::endl;
+         return 0;
+      }
+
+      const auto blocks = options.at( "blocks" ).as<uint32_t>();
+      const auto trxs_per_block = options.at( "trxs-per-block" ).as<uint32_t>();
+      const auto actions_per_trx = options.at( "actions-per-trx" ).as<uint32_t>();
+      const auto lag = options.at( "irreversible-lag" ).as<uint32_t>();
+      const auto fork_every = options.at( "fork-every" ).as<uint32_t>();
+      const auto thr_pool_size = options.at( "elastic-thread-pool-size" ).as<size_t>();
+      const auto bulk_size = options.at( "elastic-bulk-size-mb" ).as<size_t>();
+
+      std::printf( "generating %u blocks, %u transactions per block, %u actions per transaction\n",
+                   blocks, trxs_per_block, actions_per_trx );
+      eosio::benchmark::fixture_builder builder( trxs_per_block, actions_per_trx );
+      std::vector<eosio::benchmark::fixture_builder::block_fixture> fixtures;
+      std::map<uint32_t, eosio::benchmark::fixture_builder::block_fixture> forks; ///< by the index of the block they compete with
+      fixtures.reserve( blocks );
+      for( uint32_t i = 0; i < blocks; ++i ) {
+         fixtures.emplace_back( builder.next_block() );
+         if( fork_every && (i + 1) % fork_every == 0 ) {
+            forks.emplace( i, builder.fork_block() );
+         }
+      }
+
+      // ids of the forked blocks, set once their documents were deleted
+      std::map<std::string, bool> cleaned_up;
+      for( const auto& f : forks ) {
+         cleaned_up.emplace( f.second.block_state->id.str(), false );
+      }
+      std::mutex cleanup_mtx;
+      uint64_t late_orphaned_bulks = 0;
+
+      latency_recorder latency;
+      mock_elasticsearch es(
+         [&]( const std::string& body ) {
+            latency.delivered( body );
+            std::lock_guard<std::mutex> guard(cleanup_mtx);
+            for( const auto& c : cleaned_up ) {
+               if( c.second && body.find( c.first ) != std::string::npos ) ++late_orphaned_bulks;
+            }
+         },
+         [&]( const std::string& path, const std::string& body ) {
+            std::lock_guard<std::mutex> guard(cleanup_mtx);
+            for( auto& c : cleaned_up ) {
+               if( body.find( c.first ) != std::string::npos ) c.second = true;
+            }
+         } );
+      const std::vector<std::string> url_list{ es.url() };
+
+      fc::temp_directory abi_dir;
+      clock_type::time_point start_time;
+      {
+         eosio::elasticsearch_plugin_impl impl;
+         impl.budget.reset( new eosio::memory_budget(options.at( "elastic-memory-budget-mb" ).as<size_t>() * 1024 * 1024) );
+         impl.start_block_reached = true;
+         impl.serializer.reset( new ::serializer(abi_dir.path(), fc::microseconds::maximum(), 64*1024*1024ll) );
+         impl.serializer->upsert_abi_cache( N(eosio.token), eosio::benchmark::token_abi() );
+         impl.es_client.reset( new eosio::elastic_client(url_list, "", "") );
+         if( fork_every ) {
+            impl.fork_handling = eosio::elasticsearch_plugin_impl::fork_handling_type::remove;
+            impl.fork_es_client.reset( new eosio::elastic_client(url_list, "", "") );
+         }
+         impl.action_traces_router.reset( new eosio::index_router(impl.action_traces_index, eosio::index_router::partition_type::none, 1,
+                                          url_list, "", "") );
+         impl.worker_pool.reset( new eosio::thread_pool(thr_pool_size, 256 * 1024 * 1024) );
+         impl.account_lane.reset( new eosio::account_upsert_lane(1024,
+            [&impl]( std::vector<eosio::account_upserts>& batch ) { impl.write_account_upserts( batch ); }) );
+         impl.bulk_pool.reset( new eosio::bulker_pool(thr_pool_size, bulk_size * 1024 * 1024, url_list, "", "",
+                                                   nullptr, nullptr, impl.budget.get()) );
+         impl.init();
+
+         allocations = 0;
+         count_allocations = true;
+         start_time = clock_type::now();
+
+         for( uint32_t i = 0; i < blocks; ++i ) {
+            auto& fixture = fixtures[i];
+            for( auto& trace : fixture.traces ) {
+               {
+                  untracked_scope u;
+                  for( auto& atrace : trace->action_traces ) {
+                     latency.submitted( std::to_string(atrace.receipt.global_sequence) );
+                  }
+                  latency.submitted( trace->id.str() );
+               }
+
+               auto t = clock_type::now();
+               impl.applied_transaction( trace );
+               auto d = clock_type::now() - t;
+               untracked_scope u;
+               latency.sample( "signal applied_transaction", d );
+            }
+
+            {
+               untracked_scope u;
+               latency.submitted( fixture.block_state->id.str() );
+            }
+            auto t = clock_type::now();
+            impl.accepted_block( fixture.block_state );
+            auto d = clock_type::now() - t;
+            {
+               untracked_scope u;
+               latency.sample( "signal accepted_block", d );
+            }
+
+            auto fork = forks.find( i );
+            if( fork != forks.end() ) {
+               for( auto& trace : fork->second.traces ) {
+                  impl.applied_transaction( trace );
+               }
+               impl.accepted_block( fork->second.block_state );
+            }
+
+            if( i >= lag ) {
+               t = clock_type::now();
+               impl.applied_irreversible_block( fixtures[i - lag].block_state );
+               d = clock_type::now() - t;
+               untracked_scope u;
+               latency.sample( "signal irreversible_block", d );
+            }
+         }
+         for( uint32_t i = blocks > lag ? blocks - lag : 0; i < blocks; ++i ) {
+            impl.applied_irreversible_block( fixtures[i].block_state );
+         }
+         // leaving the scope drains the consume thread, the thread pool and the bulkers
+      }
+      const auto elapsed = std::chrono::duration<double>( clock_type::now() - start_time ).count();
+      count_allocations = false;
+
+      const auto docs = es.bulk_documents();
+      std::printf( "\n%-36s %12.3f\n", "elapsed (s)", elapsed );
+      std::printf( "%-36s %12llu\n", "documents", static_cast<unsigned long long>(docs) );
+      std::printf( "%-36s %12.1f\n", "documents/s", docs / elapsed );
+      std::printf( "%-36s %12llu\n", "bulk requests", static_cast<unsigned long long>(es.bulk_requests()) );
+      std::printf( "%-36s %12.2f\n", "bulk MB/s", es.bulk_bytes() / elapsed / (1024 * 1024) );
+      std::printf( "%-36s %12.1f\n", "allocations/document", docs ? static_cast<double>(allocations) / docs : 0.0 );
+      std::printf( "%-36s %12.1f\n\n", "bytes/document", docs ? static_cast<double>(es.bulk_bytes()) / docs : 0.0 );
+      latency.report();
+
+      if( fork_every ) {
+         size_t cleaned = std::count_if( cleaned_up.begin(), cleaned_up.end(), []( const std::pair<const std::string, bool>& c ) { return c.second; } );
+         std::printf( "\n%-36s %12zu\n", "forked blocks cleaned up", cleaned );
+         std::printf( "%-36s %12llu\n", "bulks with orphans after cleanup", static_cast<unsigned long long>(late_orphaned_bulks) );
+         if( cleaned != cleaned_up.size() || late_orphaned_bulks ) {
+            elog( "documents of forked blocks were not cleaned up" );
+            return -1;
+         }
+      }
+   } catch( const fc::exception& e ) {
+      elog( "${e}", ("e", e.to_detail_string()) );
+      return -1;
+   } catch( const std::exception& e ) {
+      elog( "${e}", ("e", e.what()) );
+      return -1;
+   }
+   return 0;
+}
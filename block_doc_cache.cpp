@@ -0,0 +1,25 @@
+#include "block_doc_cache.hpp"
+
+namespace eosio {
+
+void block_doc_cache::put( uint32_t block_num, const chain::block_id_type &id, block_docs_ptr docs ) {
+   std::lock_guard<std::mutex> guard(mtx);
+   entries[block_num][id] = std::move(docs);
+}
+
+block_docs_ptr block_doc_cache::take( uint32_t block_num, const chain::block_id_type &id ) {
+   std::lock_guard<std::mutex> guard(mtx);
+   block_docs_ptr docs;
+
+   auto itr = entries.begin();
+   while ( itr != entries.end() && itr->first <= block_num ) {
+      if ( itr->first == block_num ) {
+         auto found = itr->second.find( id );
+         if ( found != itr->second.end() ) docs = std::move( found->second );
+      }
+      itr = entries.erase( itr );
+   }
+   return docs;
+}
+
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <eosio/chain/types.hpp>
+
+namespace eosio {
+
+/// JSON sources of the blocks and block_states documents of a block, empty if not stored
+struct block_docs {
+   std::string block_state; ///< without validated and in_current_chain, which are added when it is written
+   std::string block;
+};
+
+using block_docs_ptr = std::shared_ptr<const block_docs>;
+
+/**
+ *  Keeps the documents built for an accepted block until the block becomes
+ *  irreversible, so the ABI-decoded block and the block_state are serialized
+ *  once and reused for the irreversible documents. Entries of blocks below the
+ *  last irreversible block, i.e. orphaned ones, are dropped.
+ */
+class block_doc_cache
+{
+public:
+   void put( uint32_t block_num, const chain::block_id_type &id, block_docs_ptr docs );
+
+   /// @return the documents of id, nullptr if not cached
+   block_docs_ptr take( uint32_t block_num, const chain::block_id_type &id );
+
+private:
+   mutable std::mutex mtx;
+   std::map<uint32_t, std::map<chain::block_id_type, block_docs_ptr>> entries;
+};
+
+}
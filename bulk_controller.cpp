@@ -0,0 +1,84 @@
+#include <algorithm>
+
+#include <fc/log/logger.hpp>
+
+#include "bulk_controller.hpp"
+
+namespace eosio {
+
+bulk_controller::bulk_controller(size_t bulk_size, size_t max_in_flight):
+   adaptive(false), min_size(bulk_size), max_size(bulk_size), max_in_flight(std::max<size_t>(max_in_flight, 1)), step(0),
+   size(bulk_size), in_flight_limit(this->max_in_flight) {}
+
+bulk_controller::bulk_controller(size_t bulk_size, size_t min_size, size_t max_size, size_t max_in_flight,
+                                 fc::microseconds target_latency):
+   adaptive(true), min_size(min_size), max_size(std::max(min_size, max_size)), max_in_flight(std::max<size_t>(max_in_flight, 1)),
+   step(std::max<size_t>((this->max_size - min_size) / 16, 64 * 1024)), target_latency(target_latency),
+   size(std::min(std::max(bulk_size, min_size), this->max_size)), in_flight_limit(this->max_in_flight) {}
+
+void bulk_controller::acquire() {
+   std::unique_lock<std::mutex> lock(mtx);
+   cv.wait( lock, [this]() { return in_flight < in_flight_limit; } );
+   ++in_flight;
+}
+
+void bulk_controller::release() {
+   {
+      std::lock_guard<std::mutex> guard(mtx);
+      --in_flight;
+   }
+   cv.notify_one();
+}
+
+void bulk_controller::completed( fc::microseconds round_trip, fc::microseconds took ) {
+   std::lock_guard<std::mutex> guard(mtx);
+   ++requests;
+   last_round_trip = round_trip;
+   last_took = took;
+   if ( !adaptive ) return;
+
+   if ( round_trip > target_latency ) {
+      size = std::max( min_size, size * 3 / 4 );
+      fast_requests = 0;
+      // the cluster itself is slow, not just the transfer: fewer requests at once. The requests sent
+      // under the previous limit are all counted first, so one burst of slow answers lowers it once
+      if ( took > target_latency && ++slow_requests >= in_flight_limit ) {
+         slow_requests = 0;
+         in_flight_limit = std::max<size_t>( 1, in_flight_limit * 3 / 4 );
+      }
+   } else {
+      slow_requests = 0;
+      size = std::min( max_size, size + step );
+      if ( ++fast_requests >= in_flight_limit ) {
+         fast_requests = 0;
+         if ( in_flight_limit < max_in_flight ) {
+            ++in_flight_limit;
+            cv.notify_one();
+         }
+      }
+   }
+   maybe_log();
+}
+
+void bulk_controller::rejected() {
+   std::lock_guard<std::mutex> guard(mtx);
+   ++rejections;
+   if ( !adaptive ) return;
+
+   size = std::max( min_size, size / 2 );
+   in_flight_limit = std::max<size_t>( 1, in_flight_limit / 2 );
+   fast_requests = 0;
+   slow_requests = 0;
+   maybe_log();
+}
+
+void bulk_controller::maybe_log() {
+   auto now = fc::time_point::now();
+   if ( now - last_log < fc::seconds(10) ) return;
+   last_log = now;
+   ilog( "bulk size: ${s} bytes, in flight limit: ${l}, round trip: ${r}us, took: ${t}us, requests: ${n}, rejections: ${x}",
+         ("s", size.load())("l", in_flight_limit)("r", last_round_trip.count())("t", last_took.count())
+         ("n", requests)("x", rejections) );
+}
+
+}
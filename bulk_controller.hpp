@@ -0,0 +1,64 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+#include <fc/time.hpp>
+
+namespace eosio {
+
+/**
+ *  Chooses the size of bulk requests and how many of them may be in flight at
+ *  once. In adaptive mode it follows the cluster AIMD style: a request answered
+ *  within the target latency grows the size additively and, after a window of
+ *  such requests, allows one more concurrent request; a slow request shrinks
+ *  the size by a quarter. When elasticsearch itself took longer than the target
+ *  for a window of requests, the concurrency shrinks by a quarter as well, and
+ *  a 429 rejection halves both. A fixed controller keeps the configured size
+ *  and does not limit concurrency. The state is logged every 10 seconds.
+ */
+class bulk_controller
+{
+public:
+   /// fixed bulk size
+   bulk_controller(size_t bulk_size, size_t max_in_flight);
+   /// adaptive bulk size between min_size and max_size, starting at bulk_size
+   bulk_controller(size_t bulk_size, size_t min_size, size_t max_size, size_t max_in_flight,
+                   fc::microseconds target_latency);
+
+   size_t bulk_size() const { return size; }
+
+   /// blocks until another request may be sent
+   void acquire();
+   void release();
+
+   /// @param took the time elasticsearch reports for the bulk, round_trip adds the transfer and queueing
+   void completed( fc::microseconds round_trip, fc::microseconds took );
+   void rejected();
+
+private:
+   void maybe_log();
+
+   const bool adaptive;
+   const size_t min_size;
+   const size_t max_size;
+   const size_t max_in_flight;
+   const size_t step;
+   const fc::microseconds target_latency;
+
+   std::atomic<size_t> size;
+   size_t in_flight_limit;
+   size_t in_flight = 0;
+   size_t fast_requests = 0;
+   size_t slow_requests = 0; ///< in a row that elasticsearch took too long for
+   uint64_t requests = 0;
+   uint64_t rejections = 0;
+   fc::microseconds last_round_trip;
+   fc::microseconds last_took;
+   fc::time_point last_log;
+
+   mutable std::mutex mtx;
+   std::condition_variable cv;
+};
+
+}
@@ -1,12 +1,24 @@
+#include <algorithm>
+#include <chrono>
+
+#include <fc/scoped_exit.hpp>
+
 #include "bulker.hpp"
 #include "exceptions.hpp"
 
 namespace eosio {
 
+namespace {
+
+/// with the backoff below, a bulk is given up after about 16 seconds of rejections
+const uint32_t max_rejected_retries = 8;
+
+}
+
 bulker::~bulker() {
    ilog("draining bulker, size: ${n}", ("n", body_size));
    if ( !body->empty() ) {
-      perform( std::move(body) );
+      perform( std::move(body), std::move(body_blocks) );
    }
 }
 
@@ -14,52 +26,153 @@ size_t bulker::size() {
    return body_size;
 }
 
-void bulker::perform( std::unique_ptr<std::string> &&body) {
+void bulker::perform( std::unique_ptr<std::string> &&body, block_counts &&blocks ) {
    std::unique_ptr<std::string> bulk( std::move(body) );
+   // the body is dropped on every path out of here, failed bulks included
+   auto give_back = fc::make_scoped_exit( [this, &bulk]() { if ( budget ) budget->release( bulk->size() ); } );
 
    // dlog("bulk size: ${s}", ("s", bulk->size() ));
 
    std::lock_guard<std::mutex> guard(client_mtx);
-   try {
-      es_client.bulk_perform( *bulk );
-   } catch (... ) {
-      handle_elasticsearch_exception( "bulk exception", __LINE__ );
+   if ( controller ) controller->acquire();
+   auto release = fc::make_scoped_exit( [this]() { if ( controller ) controller->release(); } );
+
+   for ( uint32_t attempt = 0; ; ++attempt ) {
+      auto start = fc::time_point::now();
+      try {
+         auto took = es_client.bulk_perform( *bulk );
+         if ( controller ) controller->completed( fc::time_point::now() - start, fc::milliseconds(took) );
+         break;
+      } catch ( chain::bulk_rejected_exception& e ) {
+         if ( controller ) controller->rejected();
+         if ( attempt >= max_rejected_retries || stopping ) {
+            fail( blocks, "bulk rejected " + std::to_string( attempt + 1 ) + " times" );
+            return;
+         }
+         // the cluster is overloaded, back off and send the same bulk again
+         auto backoff = std::min<int64_t>( 100ll << std::min<uint32_t>(attempt, 6), 5000 );
+         wlog( "bulk rejected, retrying in ${ms}ms", ("ms", backoff) );
+         std::unique_lock<std::mutex> lock(stop_mtx);
+         stop_cv.wait_for( lock, std::chrono::milliseconds(backoff), [this]() { return stopping.load(); } );
+      } catch (... ) {
+         fail( blocks, "bulk exception" );
+         return;
+      }
+   }
+
+   if ( tracker && !blocks.empty() ) {
+      tracker->ack( blocks );
+   }
+}
+
+void bulker::fail( const block_counts &blocks, const std::string &desc ) {
+   ++failures;
+   if ( on_error ) {
+      on_error( desc, __LINE__ );
+   } else {
+      handle_elasticsearch_exception( desc, __LINE__ );
+   }
+   // the checkpoint stays behind the documents of a failed bulk, a restart indexes them again
+   if ( tracker && !blocks.empty() ) {
+      tracker->fail( blocks );
+   }
+}
+
+void bulker::stop_retrying() {
+   {
+      std::lock_guard<std::mutex> guard(stop_mtx);
+      stopping = true;
    }
+   stop_cv.notify_all();
 }
 
-void bulker::append_document( std::string action, std::string source ) {
+void bulker::append_document( std::string action, std::string source, uint32_t block_num ) {
    bool trigger = false;
    std::unique_ptr<std::string> temp( new std::string() );
+   block_counts temp_blocks;
 
    std::string doc( std::move(action) );
    doc.push_back('\n');
-   doc.append( std::move(source) );
-   doc.push_back('\n');
+   if ( !source.empty() ) {
+      doc.append( std::move(source) );
+      doc.push_back('\n');
+   }
+
+   // never waits, the bulkers are the stage that returns credits
+   if ( budget ) budget->consume( doc.size() );
 
    {
       std::lock_guard<std::mutex> guard(body_mtx);
       body->append( doc );
       body_size = body->size();
 
-      if ( body_size >= bulk_size ) {
+      if ( tracker && block_num ) {
+         tracker->add( block_num );
+         ++body_blocks[block_num];
+      }
+
+      if ( body_size >= (controller ? controller->bulk_size() : bulk_size) ) {
          body.swap( temp );
+         body_blocks.swap( temp_blocks );
          body_size = 0;
          trigger = true;
       }
    }
 
    if ( trigger ) {
-      perform( std::move(temp) );
+      perform( std::move(temp), std::move(temp_blocks) );
+   }
+}
+
+void bulker::flush() {
+   std::unique_ptr<std::string> temp( new std::string() );
+   block_counts temp_blocks;
+
+   {
+      std::lock_guard<std::mutex> guard(body_mtx);
+      if ( body->empty() ) return;
+      body.swap( temp );
+      body_blocks.swap( temp_blocks );
+      body_size = 0;
    }
+
+   perform( std::move(temp), std::move(temp_blocks) );
 }
 
 bulker_pool::bulker_pool(size_t size, size_t bulk_size,
                          const std::vector<std::string> url_list,
-                         const std::string &user, const std::string &password): pool_size(size), bulk_size(bulk_size)
+                         const std::string &user, const std::string &password,
+                         checkpoint_tracker *tracker,
+                         std::unique_ptr<bulk_controller> controller,
+                         memory_budget *budget,
+                         bulk_error_handler on_error):
+   controller(controller ? std::move(controller) : std::unique_ptr<bulk_controller>(new bulk_controller(bulk_size, size))),
+   pool_size(size)
 {
    for (int i = 0; i < pool_size; ++i) {
-      bulkers.emplace_back( new bulker(bulk_size, url_list, user, password) );
+      bulkers.emplace_back( new bulker(bulk_size, url_list, user, password, tracker, this->controller.get(),
+                                           budget, on_error) );
+   }
+}
+
+void bulker_pool::flush() {
+   for ( auto& b : bulkers ) {
+      b->flush();
+   }
+}
+
+void bulker_pool::stop_retrying() {
+   for ( auto& b : bulkers ) {
+      b->stop_retrying();
+   }
+}
+
+uint64_t bulker_pool::failed_bulks() const {
+   uint64_t failed = 0;
+   for ( const auto& b : bulkers ) {
+      failed += b->failed_bulks();
    }
+   return failed;
 }
 
 bulker& bulker_pool::get() {
@@ -71,7 +184,7 @@ bulker& bulker_pool::get() {
 
    auto ptr = bulkers[cur_idx].get();
 
-   if ( ptr->size() >= bulk_size ) {
+   if ( ptr->size() >= controller->bulk_size() ) {
       cur_idx = (cur_idx + 1) % pool_size;
       index = cur_idx;
       return *bulkers[cur_idx].get();
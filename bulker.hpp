@@ -1,33 +1,67 @@
 #pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
 #include <mutex>
 
 #include "elastic_client.hpp"
+#include "checkpoint.hpp"
+#include "bulk_controller.hpp"
+#include "memory_budget.hpp"
 
 namespace eosio {
 
+/// called inside the catch block of a failed bulk, handle_elasticsearch_exception if not set
+using bulk_error_handler = std::function<void( const std::string& desc, int line_num )>;
+
 class bulker
 {
 public:
 
    bulker(size_t bulk_size,
           const std::vector<std::string> url_list,
-          const std::string &user, const std::string &password):
-      bulk_size(bulk_size), es_client(url_list, user, password), body(new std::string()) {}
+          const std::string &user, const std::string &password,
+          checkpoint_tracker *tracker = nullptr, bulk_controller *controller = nullptr,
+          memory_budget *budget = nullptr, bulk_error_handler on_error = nullptr):
+      bulk_size(bulk_size), es_client(url_list, user, password), body(new std::string()), tracker(tracker),
+      controller(controller), budget(budget), on_error(std::move(on_error)) {}
    ~bulker();
-   
-   void append_document( std::string action, std::string source );
+
+   /// @param source empty for actions without a source line, i.e. delete
+   /// @param block_num the block the document belongs to, 0 if it should not hold back the checkpoint
+   void append_document( std::string action, std::string source, uint32_t block_num = 0 );
+
+   /// send the buffered documents now instead of waiting for the bulk size to be reached
+   void flush();
 
    size_t size();
 
+   /// @return the number of bulk requests that failed or were rejected too many times
+   uint64_t failed_bulks() const { return failures; }
+
+   /// a rejected bulk is not sent again from now on, a waiting retry gives up at once
+   void stop_retrying();
+
 private:
    size_t bulk_size = 0;
    size_t body_size = 0;
 
-   void perform( std::unique_ptr<std::string> &&body );
+   void perform( std::unique_ptr<std::string> &&body, block_counts &&blocks );
+   /// called while the error of the bulk is handled
+   void fail( const block_counts &blocks, const std::string &desc );
 
    elastic_client es_client;
    std::unique_ptr<std::string> body;
+   block_counts body_blocks;
+   checkpoint_tracker *tracker;
+   bulk_controller *controller; ///< decides the bulk size if set
+   memory_budget *budget; ///< holds the bytes of the body until it is sent, if set
+   bulk_error_handler on_error;
+   std::atomic<uint64_t> failures{0};
 
+   std::atomic<bool> stopping{false};
+   std::mutex stop_mtx;
+   std::condition_variable stop_cv; ///< wakes a retry waiting for its backoff
 
    std::mutex client_mtx;
    std::mutex body_mtx;
@@ -36,16 +70,31 @@ private:
 class bulker_pool
 {
 public:
+   /// @param controller adjusts the bulk size, nullptr for a fixed bulk_size
+   /// @param budget charged for the buffered and in flight bulk bodies, nullptr for no limit
+   /// @param on_error logs a failed bulk, the default also quits the application
    bulker_pool(size_t size, size_t bulk_size,
                const std::vector<std::string> url_list,
-               const std::string &user, const std::string &password);
+               const std::string &user, const std::string &password,
+               checkpoint_tracker *tracker = nullptr,
+               std::unique_ptr<bulk_controller> controller = nullptr,
+               memory_budget *budget = nullptr,
+               bulk_error_handler on_error = nullptr);
 
    bulker& get();
 
+   void flush();
+
+   /// called on shutdown, so a rejecting cluster cannot hold it up
+   void stop_retrying();
+
+   /// @return the number of failed bulk requests of all bulkers
+   uint64_t failed_bulks() const;
+
 private:
+   std::unique_ptr<bulk_controller> controller;
    std::vector<std::unique_ptr<bulker>> bulkers;
    size_t pool_size;
-   size_t bulk_size;
    std::atomic<size_t> index {0};
 };
 
@@ -0,0 +1,135 @@
+#include <fc/io/json.hpp>
+#include <fc/variant_object.hpp>
+
+#include "checkpoint.hpp"
+#include "exceptions.hpp"
+
+namespace eosio {
+
+checkpoint_tracker::~checkpoint_tracker() {
+   auto block_num = acknowledged();
+   if ( block_num > persisted ) {
+      ilog("persisting elasticsearch checkpoint, block_num: ${n}", ("n", block_num));
+      persist( block_num );
+   }
+}
+
+uint32_t checkpoint_tracker::load() {
+   uint32_t block_num = 0;
+   try {
+      if ( bfs::exists(file) ) {
+         block_num = fc::json::from_file( file )["block_num"].as<uint32_t>();
+      } else if ( es_client.doc_exist(index_name, id) ) {
+         fc::variant res;
+         es_client.get( index_name, id, res );
+         block_num = res["_source"]["block_num"].as<uint32_t>();
+      }
+   } catch( ... ) {
+      handle_elasticsearch_exception( "load checkpoint", __LINE__ );
+   }
+   persisted = block_num;
+   return block_num;
+}
+
+void checkpoint_tracker::begin( uint32_t block_num ) {
+   std::lock_guard<std::mutex> guard(mtx);
+   ++pending[block_num];
+}
+
+void checkpoint_tracker::end( uint32_t block_num ) {
+   release( block_num, 1 );
+   maybe_persist();
+}
+
+void checkpoint_tracker::add( uint32_t block_num ) {
+   std::lock_guard<std::mutex> guard(mtx);
+   ++pending[block_num];
+}
+
+void checkpoint_tracker::ack( const block_counts &blocks ) {
+   for ( const auto& b : blocks ) {
+      release( b.first, b.second );
+   }
+   maybe_persist();
+}
+
+void checkpoint_tracker::fail( const block_counts &blocks ) {
+   uint32_t lowest = 0;
+   for ( const auto& b : blocks ) {
+      if ( !lowest || b.first < lowest ) lowest = b.first;
+   }
+   if ( lowest ) {
+      std::lock_guard<std::mutex> guard(mtx);
+      if ( !first_failed || lowest < first_failed ) {
+         first_failed = lowest;
+         elog("documents of block ${b} failed to index, the elasticsearch checkpoint stops at ${c} until nodeos is restarted",
+              ("b", lowest)("c", lowest - 1));
+      }
+   }
+   ack( blocks );
+}
+
+void checkpoint_tracker::irreversible( uint32_t block_num ) {
+   std::lock_guard<std::mutex> guard(mtx);
+   if ( block_num > last_irreversible ) last_irreversible = block_num;
+}
+
+uint32_t checkpoint_tracker::acknowledged() {
+   std::lock_guard<std::mutex> guard(mtx);
+   return acknowledged_locked();
+}
+
+uint32_t checkpoint_tracker::acknowledged_locked() const {
+   uint32_t block_num = last_irreversible;
+   if ( !pending.empty() && pending.begin()->first <= block_num ) {
+      block_num = pending.begin()->first - 1;
+   }
+   if ( first_failed && first_failed <= block_num ) {
+      block_num = first_failed - 1;
+   }
+   return block_num;
+}
+
+void checkpoint_tracker::release( uint32_t block_num, int64_t n ) {
+   std::lock_guard<std::mutex> guard(mtx);
+   auto it = pending.find( block_num );
+   if ( it == pending.end() ) return;
+   it->second -= n;
+   if ( it->second <= 0 ) pending.erase( it );
+}
+
+void checkpoint_tracker::maybe_persist() {
+   auto block_num = acknowledged();
+   if ( block_num < persisted + interval ) return;
+
+   std::unique_lock<std::mutex> guard(persist_mtx, std::try_to_lock);
+   if ( !guard.owns_lock() || block_num <= persisted ) return;
+   persist( block_num );
+}
+
+void checkpoint_tracker::persist( uint32_t block_num ) {
+   fc::mutable_variant_object doc;
+   doc("block_num", block_num);
+   doc("updated_at", fc::time_point::now());
+
+   try {
+      auto tmp = file;
+      tmp += ".tmp";
+      fc::json::save_to_file( doc, tmp );
+      bfs::rename( tmp, file );
+   } catch( const std::exception& e ) {
+      wlog("failed to write checkpoint file ${f}: ${e}", ("f", file.string())("e", e.what()));
+   } catch( fc::exception& e ) {
+      wlog("failed to write checkpoint file ${f}: ${e}", ("f", file.string())("e", e.to_string()));
+   }
+
+   try {
+      es_client.index( index_name, fc::json::to_string(doc), id );
+   } catch( ... ) {
+      handle_elasticsearch_exception( "persist checkpoint", __LINE__ );
+   }
+
+   persisted = block_num;
+}
+
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+
+#include <boost/filesystem.hpp>
+
+#include "elastic_client.hpp"
+
+namespace eosio {
+
+namespace bfs = boost::filesystem;
+
+using block_counts = std::unordered_map<uint32_t, size_t>;
+
+/**
+ *  Tracks the highest block number whose documents have all been acknowledged
+ *  by elasticsearch, and persists it to a local file and an elasticsearch
+ *  document so indexing can resume from there after a restart.
+ *
+ *  A block is pending while a processing task for it is running (begin/end)
+ *  or while a document of it sits in an unacknowledged bulk (add/ack). The
+ *  checkpoint never passes the last irreversible block handed to processing,
+ *  since that is the last stage that produces documents for a block.
+ */
+class checkpoint_tracker
+{
+public:
+   checkpoint_tracker(const bfs::path &file, const std::string &index_name, const std::string &id, uint32_t interval,
+                      const std::vector<std::string> url_list,
+                      const std::string &user, const std::string &password):
+      file(file), index_name(index_name), id(id), interval(interval), es_client(url_list, user, password) {}
+   ~checkpoint_tracker();
+
+   /// @return the persisted checkpoint, 0 if there is none
+   uint32_t load();
+
+   void begin( uint32_t block_num );
+   void end( uint32_t block_num );
+   void add( uint32_t block_num );
+   void ack( const block_counts &blocks );
+   /**
+    *  The documents of blocks were not indexed. Their pending counts are released,
+    *  but the checkpoint stays below the lowest of them until a restart resumes
+    *  indexing from there.
+    */
+   void fail( const block_counts &blocks );
+   void irreversible( uint32_t block_num );
+
+   uint32_t acknowledged();
+
+private:
+   uint32_t acknowledged_locked() const;
+   void release( uint32_t block_num, int64_t n );
+   void maybe_persist();
+   void persist( uint32_t block_num );
+
+   bfs::path file;
+   std::string index_name;
+   std::string id;
+   uint32_t interval;
+
+   std::map<uint32_t, int64_t> pending;
+   uint32_t last_irreversible = 0;
+   uint32_t first_failed = 0; ///< lowest block with documents that failed to index, 0 if none
+   std::mutex mtx;
+
+   std::atomic<uint32_t> persisted{0};
+   elastic_client es_client;
+   std::mutex persist_mtx;
+};
+
+}
@@ -0,0 +1,121 @@
+#include <algorithm>
+
+#include <boost/algorithm/string.hpp>
+
+#include "documents.hpp"
+#include "exceptions.hpp"
+#include "format.hpp"
+
+namespace eosio {
+
+namespace {
+
+filter_entry parse_filter_entry( const std::string& s, const char* option ) {
+   std::vector<std::string> v;
+   boost::split( v, s, boost::is_any_of( ":" ));
+   EOS_ASSERT( v.size() == 3, fc::invalid_arg_exception, "Invalid value ${s} for ${o}", ("s", s)("o", option));
+   return filter_entry{v[0], v[1], v[2]};
+}
+
+}
+
+void action_filter::add_on( const std::vector<std::string>& entries ) {
+   on_star = false;
+   for( const auto& s : entries ) {
+      if( s == "*" ) {
+         on_star = true;
+         break;
+      }
+      on.insert( parse_filter_entry( s, "--elastic-filter-on" ) );
+   }
+}
+
+void action_filter::add_out( const std::vector<std::string>& entries ) {
+   for( const auto& s : entries ) {
+      out.insert( parse_filter_entry( s, "--elastic-filter-out" ) );
+   }
+}
+
+bool action_filter::include( const chain::account_name& receiver, const chain::action_name& act_name,
+                             const std::vector<chain::permission_level>& authorization ) const
+{
+   bool included = false;
+   if( on_star ) {
+      included = true;
+   } else {
+      auto itr = std::find_if( on.cbegin(), on.cend(), [&receiver, &act_name]( const auto& filter ) {
+         return filter.match( receiver, act_name, 0 );
+      } );
+      if( itr != on.cend() ) {
+         included = true;
+      } else {
+         for( const auto& a : authorization ) {
+            auto itr = std::find_if( on.cbegin(), on.cend(), [&receiver, &act_name, &a]( const auto& filter ) {
+               return filter.match( receiver, act_name, a.actor );
+            } );
+            if( itr != on.cend() ) {
+               included = true;
+               break;
+            }
+         }
+      }
+   }
+
+   if( !included ) { return false; }
+   if( out.empty() ) { return true; }
+
+   auto itr = std::find_if( out.cbegin(), out.cend(), [&receiver, &act_name]( const auto& filter ) {
+      return filter.match( receiver, act_name, 0 );
+   } );
+   if( itr != out.cend() ) { return false; }
+
+   for( const auto& a : authorization ) {
+      auto itr = std::find_if( out.cbegin(), out.cend(), [&receiver, &act_name, &a]( const auto& filter ) {
+         return filter.match( receiver, act_name, a.actor );
+      } );
+      if( itr != out.cend() ) { return false; }
+   }
+
+   return true;
+}
+
+bool action_filter::include( const chain::transaction& trx ) const
+{
+   if( include_all() ) return true;
+   for( const auto& a : trx.actions ) {
+      if( include( a.account, a.name, a.authorization ) ) return true;
+   }
+   for( const auto& a : trx.context_free_actions ) {
+      if( include( a.account, a.name, a.authorization ) ) return true;
+   }
+   return false;
+}
+
+fc::mutable_variant_object make_transaction_doc( ::serializer& s, const field_projection& fields,
+                                                 const chain::signed_transaction& trx, const chain::transaction_id_type& id,
+                                                 const fc::variant& signing_keys,
+                                                 bool accepted, bool implicit, bool scheduled )
+{
+   fc::mutable_variant_object trans_doc;
+
+   fc::from_variant( project( trx, fields, [&s]( const auto& v ) { return s.to_variant_with_abi( v ); } ), trans_doc );
+   trans_doc("trx_id", to_hex_string( id ));
+
+   if( !signing_keys.is_null() ) {
+      trans_doc("signing_keys", signing_keys);
+   }
+
+   trans_doc("accepted", accepted);
+   trans_doc("implicit", implicit);
+   trans_doc("scheduled", scheduled);
+
+   return trans_doc;
+}
+
+std::string keep_existing_upsert( const std::string& upsert_json ) {
+   // Do nothing if document already exsit.
+   return "{\"script\":{\"source\":\"int v;\",\"lang\":\"painless\"},\"scripted_upsert\":true,\"upsert\":" +
+          upsert_json + "}";
+}
+
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <set>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <eosio/chain_plugin/chain_plugin.hpp>
+#include <eosio/chain/action.hpp>
+#include <eosio/chain/transaction.hpp>
+
+#include <fc/variant.hpp>
+#include <fc/variant_object.hpp>
+
+#include "serializer.hpp"
+#include "projection.hpp"
+
+namespace eosio {
+
+/**
+ *  The parts of the documents written by both elasticsearch_plugin and
+ *  elasticsearch_backfill, so a backfilled document is the one the plugin
+ *  would have written for the same options.
+ */
+
+struct filter_entry {
+   chain::name receiver;
+   chain::name action;
+   chain::name actor;
+
+   friend bool operator<( const filter_entry& a, const filter_entry& b ) {
+      return std::tie( a.receiver, a.action, a.actor ) < std::tie( b.receiver, b.action, b.actor );
+   }
+
+   //            receiver          action       actor
+   bool match( const chain::name& rr, const chain::name& an, const chain::name& ar ) const {
+      return (receiver.value == 0 || receiver == rr) &&
+             (action.value == 0 || action == an) &&
+             (actor.value == 0 || actor == ar);
+   }
+};
+
+/// the actions selected by --elastic-filter-on and --elastic-filter-out
+struct action_filter {
+   bool on_star = true;
+   std::set<filter_entry> on;
+   std::set<filter_entry> out;
+
+   /// adds the receiver:action:actor entries of --elastic-filter-on, * selects every action
+   void add_on( const std::vector<std::string>& entries );
+   /// adds the receiver:action:actor entries of --elastic-filter-out
+   void add_out( const std::vector<std::string>& entries );
+
+   bool include_all() const { return on_star && out.empty(); }
+
+   bool include( const chain::account_name& receiver, const chain::action_name& act_name,
+                 const std::vector<chain::permission_level>& authorization ) const;
+   /// @return true if an action or context free action of trx is included
+   bool include( const chain::transaction& trx ) const;
+};
+
+/**
+ *  @return the transactions document of trx without block information
+ *  @param signing_keys left out if null
+ */
+fc::mutable_variant_object make_transaction_doc( ::serializer& s, const field_projection& fields,
+                                                 const chain::signed_transaction& trx, const chain::transaction_id_type& id,
+                                                 const fc::variant& signing_keys,
+                                                 bool accepted, bool implicit, bool scheduled );
+
+/// @return a scripted upsert of upsert_json that leaves an existing document as it is
+std::string keep_existing_upsert( const std::string& upsert_json );
+
+}
@@ -1,6 +1,7 @@
 #include <cpr/response.h>
 
 #include <fc/io/json.hpp>
+#include <fc/variant_object.hpp>
 #include <fc/log/logger.hpp>
 
 #include <boost/format.hpp>
@@ -63,6 +64,16 @@ void elastic_client::init_index(const std::string &index_name, const std::string
    }
 }
 
+void elastic_client::add_alias(const std::string &index_name, const std::string &alias)
+{
+   fc::mutable_variant_object add_doc;
+   add_doc("index", index_name);
+   add_doc("alias", alias);
+   auto body = fc::json::to_string( fc::variant_object("actions", fc::variants({ fc::variant_object("add", add_doc) })) );
+   cpr::Response resp = client.performRequest(elasticlient::Client::HTTPMethod::POST, "_aliases", body);
+   EOS_ASSERT(is_2xx(resp.status_code), chain::response_code_exception, "${code} ${text}", ("code", resp.status_code)("text", resp.text));
+}
+
 void elastic_client::delete_index(const std::string &index_name)
 {
    // retrn status code 404 if index not exists
@@ -85,9 +96,15 @@ void elastic_client::get(const std::string &index_name, const std::string &id, f
    res = fc::json::from_string(resp.text);
 }
 
-void elastic_client::search(const std::string &index_name, fc::variant &v, const std::string &query)
+void elastic_client::search(const std::string &index_name, fc::variant &v, const std::string &query, const std::string &routing)
 {
-   cpr::Response resp = client.search(index_name, "_doc", query);
+   cpr::Response resp;
+   if ( routing.empty() ) {
+      resp = client.search(index_name, "_doc", query);
+   } else {
+      auto url = boost::str(boost::format("%1%/_doc/_search?routing=%2%") % index_name % routing );
+      resp = client.performRequest(elasticlient::Client::HTTPMethod::POST, url, query);
+   }
    EOS_ASSERT(is_2xx(resp.status_code), chain::response_code_exception, "${code} ${text}", ("code", resp.status_code)("text", resp.text));
    v = fc::json::from_string(resp.text);
 }
@@ -99,6 +116,13 @@ void elastic_client::delete_by_query(const std::string &index_name, const std::s
    EOS_ASSERT(is_2xx(resp.status_code), chain::response_code_exception, "${code} ${text}", ("code", resp.status_code)("text", resp.text));
 }
 
+void elastic_client::update_by_query(const std::string &index_name, const std::string &query)
+{
+   auto url = boost::str(boost::format("%1%/_doc/_update_by_query?conflicts=proceed") % index_name );
+   cpr::Response resp = client.performRequest(elasticlient::Client::HTTPMethod::POST, url, query);
+   EOS_ASSERT(is_2xx(resp.status_code), chain::response_code_exception, "${code} ${text}", ("code", resp.status_code)("text", resp.text));
+}
+
 void elastic_client::bulk_perform(elasticlient::SameIndexBulkData &bulk)
 {
    auto index_name = bulk.indexName();
@@ -111,13 +135,22 @@ void elastic_client::bulk_perform(elasticlient::SameIndexBulkData &bulk)
    EOS_ASSERT(text_doc["errors"].as_bool() == false, chain::bulk_fail_exception, "bulk perform errors: ${text}", ("text", resp.text));
 }
 
-void elastic_client::bulk_perform(const std::string &bulk)
+uint64_t elastic_client::bulk_perform(const std::string &bulk)
 {
    cpr::Response resp = client.performRequest(elasticlient::Client::HTTPMethod::POST, "_bulk", bulk);
+   EOS_ASSERT(resp.status_code != 429, chain::bulk_rejected_exception, "${code} ${text}", ("code", resp.status_code)("text", resp.text));
    EOS_ASSERT(is_2xx(resp.status_code), chain::response_code_exception, "${code} ${text}", ("code", resp.status_code)("text", resp.text));
-   
+
    fc::variant text_doc( fc::json::from_string(resp.text) );
-   EOS_ASSERT(text_doc["errors"].as_bool() == false, chain::bulk_fail_exception, "bulk perform errors: ${text}", ("text", resp.text));
+   if ( text_doc["errors"].as_bool() ) {
+      // items rejected by a full write queue succeed when the whole bulk is sent again
+      for ( const auto& item : text_doc["items"].get_array() ) {
+         const auto& op = item.get_object().begin()->value();
+         EOS_ASSERT(op["status"].as_int64() != 429, chain::bulk_rejected_exception, "bulk items rejected: ${text}", ("text", resp.text));
+      }
+      EOS_THROW(chain::bulk_fail_exception, "bulk perform errors: ${text}", ("text", resp.text));
+   }
+   return text_doc["took"].as_uint64();
 }
 
 void elastic_client::update(const std::string &index_name, const std::string &id, const std::string &body)
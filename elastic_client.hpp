@@ -15,16 +15,20 @@ public:
 
    void delete_index(const std::string &index_name);
    void init_index(const std::string &index_name, const std::string &mappings);
+   void add_alias(const std::string &index_name, const std::string &alias);
    bool head(const std::string &url_path);
    bool doc_exist(const std::string &index_name, const std::string &id);
    void get(const std::string &index_name, const std::string &id, fc::variant &res);
    void index(const std::string &index_name, const std::string &body, const std::string &id = std::string());
    uint32_t create(const std::string &index_name, const std::string &body, const std::string &id);
    uint64_t count_doc(const std::string &index_name, const std::string &query = std::string());
-   void search(const std::string &index_name, fc::variant& v, const std::string &query);
+   /// @param routing searches only the shard of the routing, all shards if empty
+   void search(const std::string &index_name, fc::variant& v, const std::string &query, const std::string &routing = std::string());
    void delete_by_query(const std::string &index_name, const std::string &query);
+   void update_by_query(const std::string &index_name, const std::string &query);
    void bulk_perform(elasticlient::SameIndexBulkData &bulk);
-   void bulk_perform(const std::string &bulk);
+   /// @return the took time reported by elasticsearch in milliseconds
+   uint64_t bulk_perform(const std::string &bulk);
    void update(const std::string &index_name, const std::string &id, const std::string &body);
 
    elasticlient::Client client;
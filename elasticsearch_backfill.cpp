@@ -0,0 +1,542 @@
+/**
+ *  Offline backfill of the blocks and transactions indices straight from blocks.log.
+ *
+ *  The block range is split into chunks which are claimed by worker threads, so
+ *  ABI decoding and document generation run in parallel instead of being bound
+ *  by a single-threaded nodeos replay. ABIs are taken from the abi database of
+ *  an elasticsearch_plugin data dir, which holds the latest ABI of each contract,
+ *  and from the setabi actions found in blocks.log for the blocks before it.
+ */
+#include <eosio/chain_plugin/chain_plugin.hpp>
+#include <eosio/chain/block_log.hpp>
+#include <eosio/chain/config.hpp>
+#include <eosio/chain/contract_types.hpp>
+#include <eosio/chain/exceptions.hpp>
+#include <eosio/chain/transaction.hpp>
+
+#include <fc/variant.hpp>
+#include <fc/variant_object.hpp>
+
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+
+#include "elastic_client.hpp"
+#include "exceptions.hpp"
+#include "serializer.hpp"
+#include "bulker.hpp"
+#include "json_writer.hpp"
+#include "format.hpp"
+#include "projection.hpp"
+#include "documents.hpp"
+
+namespace bpo = boost::program_options;
+
+namespace eosio {
+
+using chain::block_log;
+using chain::packed_transaction;
+using chain::signed_block_ptr;
+using chain::signed_transaction;
+using chain::transaction;
+using chain::transaction_id_type;
+
+namespace {
+
+/**
+ *  handle_elasticsearch_exception without the appbase quit, the tool runs no
+ *  application. A failed bulk is counted by its bulker and the tool exits
+ *  with -1 once the other blocks are done.
+ */
+void log_bulk_exception( const std::string& desc, int line_num ) {
+   try {
+      throw;
+   } catch( const elasticlient::ConnectionException& e ) {
+      elog( "elasticsearch connection error, ${desc}, line ${line}, ${what}",
+            ("desc", desc)("line", line_num)("what", e.what()) );
+   } catch( const fc::exception& e ) {
+      elog( "elasticsearch exception, ${desc}, line ${line}, ${what}",
+            ("desc", desc)("line", line_num)("what", e.to_detail_string()) );
+   } catch( const std::exception& e ) {
+      elog( "elasticsearch std exception, ${desc}, line ${line}, ${what}",
+            ("desc", desc)("line", line_num)("what", e.what()) );
+   } catch( ... ) {
+      elog( "elasticsearch unknown exception, ${desc}, line ${line}", ("desc", desc)("line", line_num) );
+   }
+}
+
+}
+
+/**
+ *  The abis set by the setabi actions of blocks.log, so every block is decoded
+ *  with the abis in effect at that block rather than with the latest ones of
+ *  the abi database.
+ *
+ *  Only setabi actions of executed input transactions are seen, a setabi sent
+ *  by a deferred or delayed transaction only shows up in the block by its id.
+ *  Only the backfilled range is scanned, a contract whose first setabi since
+ *  first_block comes after last_block is decoded with the abi of the database.
+ */
+class abi_history
+{
+public:
+   /// scans the blocks from first_block to last_block of log
+   abi_history( block_log& log, std::mutex& log_mtx, ::serializer& s,
+                uint32_t first_block, uint32_t last_block, uint32_t chunk_size, size_t workers );
+
+   /**
+    *  @return the abi of account in effect at block_num, null to leave its data as hex:
+    *  - the abi of its last setabi before block_num, if there is one since first_block
+    *  - the abi of the database, if it set none since first_block
+    *  - null if its abi changed in block_num itself or its abi before the first setabi since first_block is unknown
+    */
+   std::shared_ptr<const abi_serializer> resolve( uint32_t block_num, const account_name& account );
+
+   /// @return the number of blocks that could not be scanned
+   uint64_t missing_blocks() const { return missing; }
+
+private:
+   struct abi_change {
+      uint32_t block_num;
+      std::shared_ptr<const abi_serializer> abis; ///< null if the abi was removed or cannot be loaded
+   };
+
+   struct account_history {
+      std::vector<abi_change> changes; ///< ordered by block
+      std::atomic<bool> warned{false};
+   };
+
+   ::serializer& s;
+   std::unordered_map<uint64_t, account_history> accounts;
+   uint64_t missing = 0;
+};
+
+abi_history::abi_history( block_log& log, std::mutex& log_mtx, ::serializer& s,
+                          uint32_t first_block, uint32_t last_block, uint32_t chunk_size, size_t workers ): s(s) {
+   if( first_block > last_block ) return;
+
+   struct found_abi {
+      account_name account;
+      uint32_t block_num;
+      uint32_t order; ///< of the action within its block
+      chain::bytes abi;
+   };
+
+   auto start_time = fc::time_point::now();
+   std::atomic<uint64_t> next_chunk{first_block};
+   std::atomic<uint64_t> missing_count{0};
+   std::vector<std::vector<found_abi>> found( workers );
+
+   auto scan = [&]( std::vector<found_abi>& result ) {
+      while( true ) {
+         uint64_t chunk_start = next_chunk.fetch_add( chunk_size );
+         if( chunk_start > last_block ) break;
+         uint64_t chunk_end = std::min<uint64_t>( chunk_start + chunk_size - 1, last_block );
+
+         for( uint64_t n = chunk_start; n <= chunk_end; ++n ) {
+            signed_block_ptr block;
+            {
+               std::lock_guard<std::mutex> guard(log_mtx);
+               block = log.read_block_by_num( n );
+            }
+            if( !block ) {
+               elog( "block ${n} not found in blocks.log", ("n", n) );
+               ++missing_count;
+               continue;
+            }
+            try {
+               uint32_t order = 0;
+               for( const auto& receipt : block->transactions ) {
+                  if( !receipt.trx.contains<packed_transaction>() ||
+                      receipt.status != chain::transaction_receipt_header::executed ) continue;
+                  const auto& raw = receipt.trx.get<packed_transaction>().get_raw_transaction();
+                  const auto& trx = fc::raw::unpack<transaction>( raw );
+                  for( const auto& a : trx.actions ) {
+                     if( a.account != chain::config::system_account_name || a.name != chain::setabi::get_name() ) continue;
+                     auto set = a.data_as<chain::setabi>();
+                     result.push_back( found_abi{set.account, static_cast<uint32_t>(n), order++, std::move(set.abi)} );
+                  }
+               }
+            } catch( const fc::exception& e ) {
+               elog( "block ${n}: ${e}", ("n", n)("e", e.to_detail_string()) );
+               ++missing_count;
+            } catch( const std::exception& e ) {
+               elog( "block ${n}: ${e}", ("n", n)("e", e.what()) );
+               ++missing_count;
+            }
+         }
+      }
+   };
+
+   std::vector<std::thread> threads;
+   for( size_t i = 0; i < workers; ++i ) {
+      threads.emplace_back( [&, i]() { scan( found[i] ); } );
+   }
+   for( auto& t : threads ) {
+      t.join();
+   }
+   missing = missing_count;
+   if( missing ) {
+      elog( "${n} blocks could not be scanned for setabi actions, the abis used after them may be wrong", ("n", missing) );
+   }
+
+   std::vector<found_abi> all;
+   for( auto& f : found ) {
+      std::move( f.begin(), f.end(), std::back_inserter(all) );
+   }
+   std::sort( all.begin(), all.end(), []( const auto& a, const auto& b ) {
+      return std::tie( a.block_num, a.order ) < std::tie( b.block_num, b.order );
+   } );
+
+   // decoded up front, resolve then only reads
+   std::vector<std::shared_ptr<const abi_serializer>> decoded( all.size() );
+   std::atomic<size_t> next{0};
+   threads.clear();
+   for( size_t i = 0; i < std::min( workers, all.size() ); ++i ) {
+      threads.emplace_back( [&]() {
+         for( size_t j = next++; j < all.size(); j = next++ ) {
+            decoded[j] = s.decode_abi( all[j].account, all[j].abi );
+         }
+      } );
+   }
+   for( auto& t : threads ) {
+      t.join();
+   }
+
+   for( size_t i = 0; i < all.size(); ++i ) {
+      accounts[all[i].account.value].changes.push_back( abi_change{all[i].block_num, std::move(decoded[i])} );
+   }
+
+   ilog( "found ${n} setabi actions of ${a} contracts in blocks ${f} - ${l}, time: ${t}",
+         ("n", all.size())("a", accounts.size())("f", first_block)("l", last_block)("t", fc::time_point::now() - start_time) );
+}
+
+std::shared_ptr<const abi_serializer> abi_history::resolve( uint32_t block_num, const account_name& account ) {
+   auto itr = accounts.find( account.value );
+   if( itr == accounts.end() ) return s.get_abi_serializer( account );
+
+   auto& history = itr->second;
+   auto next = std::lower_bound( history.changes.begin(), history.changes.end(), block_num,
+                                 []( const abi_change& c, uint32_t n ) { return c.block_num < n; } );
+   if( next != history.changes.end() && next->block_num == block_num ) {
+      // actions before and after the setabi of the block are decoded in one go
+      return nullptr;
+   }
+   if( next == history.changes.begin() ) {
+      if( !history.warned.exchange( true ) ) {
+         wlog( "the abi of ${a} before block ${b} is unknown, its data is stored as hex before that block, "
+               "start an earlier backfill to decode it", ("a", account)("b", next->block_num) );
+      }
+      return nullptr;
+   }
+   return std::prev( next )->abis;
+}
+
+class backfill
+{
+public:
+   backfill(const bfs::path& blocks_dir, const bpo::variables_map& options);
+
+   /// @return the number of blocks and bulk requests that failed
+   uint64_t run( uint32_t first_block, uint32_t last_block, uint32_t chunk_size, size_t workers );
+
+private:
+   void process_block( const signed_block_ptr& block );
+
+   template<typename T>
+   fc::variant project_with_abi( const T& obj, const field_projection& p, uint32_t block_num ) {
+      return project( obj, p, [this, block_num]( const auto& v ) {
+         return serializer->to_variant_with_abi( v, [this, block_num]( const account_name& n ) {
+            return abis->resolve( block_num, n );
+         } );
+      } );
+   }
+
+   block_log log;
+   std::mutex log_mtx;
+
+   fc::optional<chain::chain_id_type> chain_id;
+   std::unique_ptr<::serializer> serializer;
+   std::unique_ptr<abi_history> abis;
+   std::unique_ptr<bulker_pool> bulk_pool;
+
+   bool store_blocks = true;
+   bool store_transactions = true;
+   std::string blocks_index;
+   std::string trans_index;
+   action_filter filter;
+   field_projection blocks_fields;
+   field_projection trans_fields;
+};
+
+backfill::backfill(const bfs::path& blocks_dir, const bpo::variables_map& options): log(blocks_dir) {
+   fc::microseconds abi_serializer_max_time = fc::milliseconds( options.at( "abi-serializer-max-time-ms" ).as<uint32_t>() );
+   auto db_size = options.at( "elastic-abi-db-size-mb" ).as<size_t>();
+   serializer.reset( new ::serializer(options.at( "abi-dir" ).as<bfs::path>(), abi_serializer_max_time, db_size*1024*1024ll) );
+
+   if( options.count( "chain-id" ) ) {
+      chain_id.emplace( options.at( "chain-id" ).as<std::string>() );
+   }
+
+   store_blocks = options.at( "elastic-store-blocks" ).as<bool>();
+   store_transactions = options.at( "elastic-store-transactions" ).as<bool>();
+   blocks_index = options.at( "elastic-index-blocks" ).as<std::string>();
+   trans_index = options.at( "elastic-index-transactions" ).as<std::string>();
+   if( options.count( "elastic-filter-on" ) ) {
+      filter.add_on( options.at( "elastic-filter-on" ).as<std::vector<std::string>>() );
+   }
+   if( options.count( "elastic-filter-out" ) ) {
+      filter.add_out( options.at( "elastic-filter-out" ).as<std::vector<std::string>>() );
+   }
+   blocks_fields = field_projection::parse( options.at( "elastic-blocks-fields" ).as<std::string>() );
+   trans_fields = field_projection::parse( options.at( "elastic-transactions-fields" ).as<std::string>() );
+
+   std::string url_str = options.at( "elastic-url" ).as<std::string>();
+   if ( url_str.back() != '/' ) url_str.push_back('/');
+   std::string user_str = options.at( "elastic-user" ).as<std::string>();
+   std::string password_str = options.at( "elastic-password" ).as<std::string>();
+   size_t pool_size = options.at( "workers" ).as<size_t>();
+   size_t bulk_size = options.at( "elastic-bulk-size-mb" ).as<size_t>();
+
+   elastic_client es_client( std::vector<std::string>({url_str}), user_str, password_str );
+   es_client.init_index( blocks_index, "" );
+   es_client.init_index( trans_index, "" );
+
+   bulk_pool.reset( new bulker_pool(pool_size, bulk_size * 1024 * 1024,
+                    std::vector<std::string>({url_str}), user_str, password_str,
+                    nullptr, nullptr, nullptr, log_bulk_exception) );
+}
+
+void backfill::process_block( const signed_block_ptr& block ) {
+   const auto block_id = block->id();
+   const auto block_id_str = to_hex_string( block_id );
+   const auto block_num = block->block_num();
+
+   if( store_blocks ) {
+      fc::mutable_variant_object block_doc;
+
+      fc::from_variant( project_with_abi( *block, blocks_fields, block_num ), block_doc );
+      block_doc("irreversible", true);
+      block_doc("validated", true);
+
+      // a block the plugin already indexed is kept as it is, like the plugin keeps what was there
+      auto action = bulk_action( "update", blocks_index, block_id_str, 100 );
+      auto json = keep_existing_upsert( to_json( block_doc ) );
+
+      bulker& bulk = bulk_pool->get();
+      bulk.append_document(std::move(action), std::move(json));
+   }
+
+   if( store_transactions ) {
+      for( const auto& receipt : block->transactions ) {
+         fc::mutable_variant_object trans_doc;
+         fc::mutable_variant_object doc;
+         std::string trx_id_str;
+
+         if( receipt.trx.contains<packed_transaction>() ) {
+            const auto& pt = receipt.trx.get<packed_transaction>();
+            const signed_transaction& trx = pt.get_signed_transaction();
+            if( !filter.include( trx ) ) continue;
+            const auto id = trx.id();
+            trx_id_str = to_hex_string( id );
+
+            fc::variant signing_keys;
+            if( chain_id ) {
+               flat_set<public_key_type> keys;
+               trx.get_signature_keys( *chain_id, fc::time_point::maximum(), keys, false );
+               signing_keys = keys;
+            }
+
+            // an input transaction, neither implicit like onblock nor scheduled like a deferred one
+            trans_doc = make_transaction_doc( *serializer, trans_fields, trx, id, signing_keys, true, false, false );
+         } else {
+            // a deferred or delayed transaction being executed, only its id is in the block;
+            // keep whatever was already indexed of it and mark it scheduled as the plugin does
+            trx_id_str = to_hex_string( receipt.trx.get<transaction_id_type>() );
+            trans_doc("accepted", true);
+            trans_doc("implicit", false);
+            trans_doc("scheduled", true);
+         }
+
+         trans_doc("irreversible", true);
+         trans_doc("block_id", block_id_str);
+         trans_doc("block_num", static_cast<int32_t>(block_num));
+
+         doc("doc", trans_doc);
+         doc("doc_as_upsert", true);
+
+         auto action = bulk_action( "update", trans_index, trx_id_str, 100 );
+         auto json = to_json( doc );
+
+         bulker& bulk = bulk_pool->get();
+         bulk.append_document(std::move(action), std::move(json));
+      }
+   }
+}
+
+uint64_t backfill::run( uint32_t first_block, uint32_t last_block, uint32_t chunk_size, size_t workers ) {
+   uint32_t head_block = 0;
+   {
+      std::lock_guard<std::mutex> guard(log_mtx);
+      const auto& head = log.head();
+      EOS_ASSERT( head, chain::block_log_exception, "blocks.log is empty" );
+      head_block = head->block_num();
+      if( last_block == 0 || last_block > head_block ) last_block = head_block;
+   }
+   EOS_ASSERT( first_block <= last_block, fc::invalid_arg_exception,
+               "invalid block range ${f} - ${l}", ("f", first_block)("l", last_block) );
+
+   if( last_block < head_block ) {
+      wlog( "setabi actions after block ${l} are not scanned, a contract that first changed its abi after it "
+            "is decoded with the latest abi of the database", ("l", last_block) );
+   }
+   abis.reset( new abi_history( log, log_mtx, *serializer, first_block, last_block, chunk_size, workers ) );
+
+   ilog( "backfill blocks ${f} - ${l}, workers: ${w}, chunk size: ${c}",
+         ("f", first_block)("l", last_block)("w", workers)("c", chunk_size) );
+
+   std::atomic<uint64_t> next_chunk{first_block};
+   std::atomic<uint32_t> blocks_done{0};
+   std::atomic<uint64_t> failed_blocks{0};
+   auto start_time = fc::time_point::now();
+
+   auto work = [&]() {
+      while( true ) {
+         uint64_t chunk_start = next_chunk.fetch_add( chunk_size );
+         if( chunk_start > last_block ) break;
+         uint64_t chunk_end = std::min<uint64_t>( chunk_start + chunk_size - 1, last_block );
+
+         for( uint64_t n = chunk_start; n <= chunk_end; ++n ) {
+            signed_block_ptr block;
+            {
+               std::lock_guard<std::mutex> guard(log_mtx);
+               block = log.read_block_by_num( n );
+            }
+            if( !block ) {
+               elog( "block ${n} not found in blocks.log", ("n", n) );
+               ++failed_blocks;
+               continue;
+            }
+            try {
+               process_block( block );
+            } catch( const fc::exception& e ) {
+               elog( "block ${n}: ${e}", ("n", n)("e", e.to_detail_string()) );
+               ++failed_blocks;
+            } catch( const std::exception& e ) {
+               elog( "block ${n}: ${e}", ("n", n)("e", e.what()) );
+               ++failed_blocks;
+            }
+         }
+
+         auto done = blocks_done.fetch_add( chunk_end - chunk_start + 1 ) + chunk_end - chunk_start + 1;
+         auto elapsed = fc::time_point::now() - start_time;
+         ilog( "chunk ${s} - ${e} done, blocks: ${d}/${t}, speed: ${b} b/s",
+               ("s", chunk_start)("e", chunk_end)("d", done)("t", last_block - first_block + 1)
+               ("b", elapsed.count() > 0 ? done * 1000000ull / elapsed.count() : 0) );
+      }
+   };
+
+   std::vector<std::thread> threads;
+   for( size_t i = 0; i < workers; ++i ) {
+      threads.emplace_back( work );
+   }
+   for( auto& t : threads ) {
+      t.join();
+   }
+
+   // send the remaining documents before counting the failed bulks
+   bulk_pool->flush();
+   const uint64_t failed_bulks = bulk_pool->failed_bulks();
+   bulk_pool.reset();
+
+   ilog( "backfill finished, time: ${t}", ("t", fc::time_point::now() - start_time) );
+   if( failed_blocks || failed_bulks ) {
+      elog( "${b} blocks and ${r} bulk requests failed, index the affected blocks again",
+            ("b", failed_blocks.load())("r", failed_bulks) );
+   }
+   return failed_blocks + failed_bulks + abis->missing_blocks();
+}
+
+}
+
+int main( int argc, char** argv ) {
+   try {
+      bpo::options_description desc("elasticsearch_backfill options");
+      desc.add_options()
+         ("help,h", "Print this help message and exit.")
+         ("blocks-dir", bpo::value<bfs::path>()->default_value("blocks"),
+          "The location of the blocks directory containing blocks.log.")
+         ("abi-dir", bpo::value<bfs::path>()->default_value("abi"),
+          "The location of the abi database of elasticsearch_plugin (<data-dir>/abi).")
+         ("elastic-abi-db-size-mb", bpo::value<size_t>()->default_value(1024),
+          "Maximum size(megabytes) of the abi database.")
+         ("abi-serializer-max-time-ms", bpo::value<uint32_t>()->default_value(1000000),
+          "Override default maximum ABI serialization time allowed in ms.")
+         ("chain-id", bpo::value<std::string>(),
+          "If specified then signing keys are recovered and stored in transactions.")
+         ("first-block", bpo::value<uint32_t>()->default_value(1),
+          "The first block to index.")
+         ("last-block", bpo::value<uint32_t>()->default_value(0),
+          "The last block to index, 0 for the head block of blocks.log.")
+         ("workers", bpo::value<size_t>()->default_value(std::max<size_t>(1, std::thread::hardware_concurrency())),
+          "The number of worker threads, each processing one chunk of blocks at a time.")
+         ("chunk-size", bpo::value<uint32_t>()->default_value(10000),
+          "The number of blocks in each chunk.")
+         ("elastic-bulk-size-mb", bpo::value<size_t>()->default_value(5),
+          "The size(megabytes) of the each bulk request.")
+         ("elastic-url,u", bpo::value<std::string>()->default_value("http://localhost:9200/"),
+          "elasticsearch URL connection string.")
+         ("elastic-user", bpo::value<std::string>()->default_value(""),
+          "elasticsearch user.")
+         ("elastic-password", bpo::value<std::string>()->default_value(""),
+          "elasticsearch password.")
+         ("elastic-store-blocks", bpo::value<bool>()->default_value(true),
+          "Enables storing blocks in elasticsearch.")
+         ("elastic-store-transactions", bpo::value<bool>()->default_value(true),
+          "Enables storing transactions in elasticsearch.")
+         ("elastic-index-blocks", bpo::value<std::string>()->default_value("blocks"),
+          "elasticsearch blocks index name.")
+         ("elastic-index-transactions", bpo::value<std::string>()->default_value("transactions"),
+          "elasticsearch transactions index name.")
+         ("elastic-filter-on", bpo::value<std::vector<std::string>>()->composing(),
+          "Store transactions with actions which match receiver:action:actor, as elasticsearch_plugin does.")
+         ("elastic-filter-out", bpo::value<std::vector<std::string>>()->composing(),
+          "Do not store transactions whose actions all match receiver:action:actor, as elasticsearch_plugin does.")
+         ("elastic-blocks-fields", bpo::value<std::string>()->default_value(""),
+          "Comma separated fields of blocks documents to store. Empty to store all.")
+         ("elastic-transactions-fields", bpo::value<std::string>()->default_value(""),
+          "Comma separated fields of transactions documents to store. Empty to store all.")
+         ;
+
+      bpo::variables_map options;
+      bpo::store( bpo::parse_command_line(argc, argv, desc), options );
+      bpo::notify( options );
+
+      if( options.count( "help" ) ) {
+         std::cout << desc << std::endl;
+         return 0;
+      }
+
+      auto chunk_size = options.at( "chunk-size" ).as<uint32_t>();
+      auto workers = options.at( "workers" ).as<size_t>();
+      EOS_ASSERT( chunk_size > 0 && workers > 0, fc::invalid_arg_exception, "--chunk-size and --workers must be greater than 0" );
+
+      eosio::backfill bf( options.at( "blocks-dir" ).as<bfs::path>(), options );
+      if( bf.run( options.at( "first-block" ).as<uint32_t>(), options.at( "last-block" ).as<uint32_t>(), chunk_size, workers ) ) {
+         return -1;
+      }
+   } catch( const fc::exception& e ) {
+      elog( "${e}", ("e", e.to_detail_string()) );
+      return -1;
+   } catch( const std::exception& e ) {
+      elog( "${e}", ("e", e.what()) );
+      return -1;
+   }
+   return 0;
+}
@@ -1,245 +1,158 @@
-#include <eosio/elasticsearch_plugin/elasticsearch_plugin.hpp>
-#include <eosio/chain/eosio_contract.hpp>
-#include <eosio/chain/config.hpp>
-#include <eosio/chain/exceptions.hpp>
-#include <eosio/chain/transaction.hpp>
-#include <eosio/chain/types.hpp>
+#include <eosio/chain/account_object.hpp>
+#include <eosio/chain/asset.hpp>
+#include <eosio/http_plugin/http_plugin.hpp>
 
 #include <fc/io/json.hpp>
-#include <fc/utf8.hpp>
+#include <fc/scoped_exit.hpp>
 #include <fc/variant.hpp>
 #include <fc/variant_object.hpp>
 
 #include <boost/format.hpp>
 #include <boost/algorithm/string.hpp>
-#include <boost/signals2/connection.hpp>
+#include <boost/container/small_vector.hpp>
 
-
-#include <thread>
-#include <mutex>
-#include <queue>
-#include <stack>
 #include <utility>
 #include <functional>
-#include <unordered_map>
 
-#include "elastic_client.hpp"
+#include "elasticsearch_plugin_impl.hpp"
 #include "exceptions.hpp"
-#include "serializer.hpp"
-#include "bulker.hpp"
-#include "ThreadPool/ThreadPool.h"
+#include "json_writer.hpp"
+#include "format.hpp"
+#include "query_api.hpp"
 
 
 namespace eosio {
 
-using chain::account_name;
-using chain::action_name;
-using chain::block_id_type;
-using chain::permission_name;
-using chain::transaction;
-using chain::signed_transaction;
-using chain::signed_block;
-using chain::transaction_id_type;
-using chain::packed_transaction;
-
-static appbase::abstract_plugin& _elasticsearch_plugin = app().register_plugin<elasticsearch_plugin>();
-
-struct filter_entry {
-   name receiver;
-   name action;
-   name actor;
-
-   friend bool operator<( const filter_entry& a, const filter_entry& b ) {
-      return std::tie( a.receiver, a.action, a.actor ) < std::tie( b.receiver, b.action, b.actor );
-   }
-
-   //            receiver          action       actor
-   bool match( const name& rr, const name& an, const name& ar ) const {
-      return (receiver.value == 0 || receiver == rr) &&
-             (action.value == 0 || action == an) &&
-             (actor.value == 0 || actor == ar);
-   }
+/// data of the transfer action of eosio.token and compatible contracts
+struct token_transfer {
+   account_name   from;
+   account_name   to;
+   chain::asset   quantity;
+   std::string    memo;
 };
 
-class elasticsearch_plugin_impl {
-public:
-   elasticsearch_plugin_impl();
-   ~elasticsearch_plugin_impl();
-
-   fc::optional<boost::signals2::scoped_connection> accepted_block_connection;
-   fc::optional<boost::signals2::scoped_connection> irreversible_block_connection;
-   fc::optional<boost::signals2::scoped_connection> accepted_transaction_connection;
-   fc::optional<boost::signals2::scoped_connection> applied_transaction_connection;
-
-   void consume_blocks();
-
-   void check_task_queue_size();
-
-   void accepted_block( const chain::block_state_ptr& );
-   void applied_irreversible_block(const chain::block_state_ptr&);
-   void accepted_transaction(const chain::transaction_metadata_ptr&);
-   void applied_transaction(const chain::transaction_trace_ptr&);
-
-   void process_applied_transaction(chain::transaction_trace_ptr);
-   void _process_applied_transaction(chain::transaction_trace_ptr);
-   void process_accepted_transaction(chain::transaction_metadata_ptr);
-   void _process_accepted_transaction(chain::transaction_metadata_ptr);
-   void process_accepted_block( chain::block_state_ptr );
-   void _process_accepted_block( chain::block_state_ptr );
-   void process_irreversible_block( chain::block_state_ptr );
-   void _process_irreversible_block( chain::block_state_ptr );
-
-   void upsert_account(
-         std::unordered_map<uint64_t, std::pair<std::string, fc::mutable_variant_object>> &account_upsert_actions,
-         const chain::action& act, const chain::block_timestamp_type& block_time );
-   void create_new_account( fc::mutable_variant_object& param_doc, const chain::newaccount& newacc, const chain::block_timestamp_type& block_time );
-   void update_account_auth( fc::mutable_variant_object& param_doc, const chain::updateauth& update );
-   void delete_account_auth( fc::mutable_variant_object& param_doc, const chain::deleteauth& del );
-   void upsert_account_setabi( fc::mutable_variant_object& param_doc, const chain::setabi& setabi );
-
-   /// @return true if act should be added to elasticsearch, false to skip it
-   bool filter_include( const account_name& receiver, const action_name& act_name,
-                        const vector<chain::permission_level>& authorization ) const;
-   bool filter_include( const transaction& trx ) const;
-
-   void init();
-
-   template<typename Queue, typename Entry> void queue(Queue& queue, const Entry& e);
-
-   bool configured{false};
-   bool delete_index_on_startup{false};
-   uint32_t start_block_num = 0;
-   std::atomic_bool start_block_reached{false};
-
-   bool filter_on_star = true;
-   std::set<filter_entry> filter_on;
-   std::set<filter_entry> filter_out;
-   bool store_blocks = true;
-   bool store_block_states = true;
-   bool store_transactions = true;
-   bool store_transaction_traces = true;
-   bool store_action_traces = true;
-
-   size_t max_task_queue_size = 0;
-   int task_queue_sleep_time = 0;
-
-   std::queue<std::function<void()>> upsert_account_task_queue;
-   std::mutex upsert_account_task_mtx;
-
-   size_t max_queue_size = 0;
-   int queue_sleep_time = 0;
-   std::deque<chain::transaction_metadata_ptr> transaction_metadata_queue;
-   std::deque<chain::transaction_metadata_ptr> transaction_metadata_process_queue;
-   std::deque<chain::transaction_trace_ptr> transaction_trace_queue;
-   std::deque<chain::transaction_trace_ptr> transaction_trace_process_queue;
-   std::deque<chain::block_state_ptr> block_state_queue;
-   std::deque<chain::block_state_ptr> block_state_process_queue;
-   std::deque<chain::block_state_ptr> irreversible_block_state_queue;
-   std::deque<chain::block_state_ptr> irreversible_block_state_process_queue;
-   std::mutex mtx;
-   std::condition_variable condition;
-   std::thread consume_thread;
-   std::atomic<bool> done{false};
-   std::atomic<bool> startup{true};
-   fc::optional<chain::chain_id_type> chain_id;
-
-   std::unique_ptr<elastic_client> es_client;
-   std::unique_ptr<serializer> serializer;
-   std::unique_ptr<bulker_pool> bulk_pool;
-   std::unique_ptr<ThreadPool> thread_pool;
-
-   static const action_name newaccount;
-   static const action_name setabi;
-   static const action_name updateauth;
-   static const action_name deleteauth;
-   static const permission_name owner;
-   static const permission_name active;
-
-   std::string accounts_index = "accounts";
-   std::string blocks_index = "blocks";
-   std::string trans_index = "transactions";
-   std::string block_states_index = "block_states";
-   std::string trans_traces_index = "transaction_traces";
-   std::string action_traces_index = "action_traces";
+}
 
-};
+FC_REFLECT( eosio::token_transfer, (from)(to)(quantity)(memo) )
 
-const action_name elasticsearch_plugin_impl::newaccount = chain::newaccount::get_name();
-const action_name elasticsearch_plugin_impl::setabi = chain::setabi::get_name();
-const action_name elasticsearch_plugin_impl::updateauth = chain::updateauth::get_name();
-const action_name elasticsearch_plugin_impl::deleteauth = chain::deleteauth::get_name();
-const permission_name elasticsearch_plugin_impl::owner = chain::config::owner_name;
-const permission_name elasticsearch_plugin_impl::active = chain::config::active_name;
+namespace eosio {
 
+namespace {
 
-bool elasticsearch_plugin_impl::filter_include( const account_name& receiver, const action_name& act_name,
-                                           const vector<chain::permission_level>& authorization ) const
-{
-   bool include = false;
-   if( filter_on_star ) {
-      include = true;
-   } else {
-      auto itr = std::find_if( filter_on.cbegin(), filter_on.cend(), [&receiver, &act_name]( const auto& filter ) {
-         return filter.match( receiver, act_name, 0 );
-      } );
-      if( itr != filter_on.cend() ) {
-         include = true;
-      } else {
-         for( const auto& a : authorization ) {
-            auto itr = std::find_if( filter_on.cbegin(), filter_on.cend(), [&receiver, &act_name, &a]( const auto& filter ) {
-               return filter.match( receiver, act_name, a.actor );
+/// @return the http handler of /v1/elasticsearch/<call_name>, answered by call on the query threads
+std::pair<std::string, url_handler> query_handler( std::shared_ptr<query_api> api, const std::string& call_name,
+                                                   void (query_api::*call)( const fc::variant&, query_api::callback ) ) {
+   return { "/v1/elasticsearch/" + call_name,
+      [api, call_name, call]( std::string, std::string body, url_response_callback cb ) {
+         try {
+            if( body.empty() ) body = "{}";
+            auto params = fc::json::from_string( body );
+            ((*api).*call)( params, [call_name, body, cb]( std::exception_ptr error, const fc::variant& result ) {
+               // answered on the application thread like the other apis, not on the query thread
+               app().get_io_service().post( [call_name, body, cb, error, result]() {
+                  if( !error ) {
+                     cb( 200, result );
+                     return;
+                  }
+                  try {
+                     std::rethrow_exception( error );
+                  } catch( ... ) {
+                     http_plugin::handle_exception( "elasticsearch", call_name.c_str(), body, cb );
+                  }
+               } );
             } );
-            if( itr != filter_on.cend() ) {
-               include = true;
-               break;
-            }
+         } catch( ... ) {
+            http_plugin::handle_exception( "elasticsearch", call_name.c_str(), body, cb );
          }
-      }
+      } };
+}
+
+/// @return object_json with the members of fields added, without parsing object_json
+std::string json_with_fields( const std::string& object_json, const fc::variant_object& fields ) {
+   auto json = to_json( fields );
+   json.pop_back(); // }
+   if( object_json.size() > 2 ) json.push_back( ',' );
+   json.append( object_json, 1, std::string::npos );
+   return json;
+}
+
+/// @return an update setting fields in an existing document, with upsert_json spliced in as is if there is none
+std::string set_fields_upsert( const fc::variant_object& fields, const std::string& upsert_json ) {
+   std::string source;
+   for( const auto& f : fields ) {
+      source += "ctx._source." + f.key() + " = params." + f.key() + ";";
    }
+   auto json = to_json( fc::mutable_variant_object()
+                           ("script", fc::mutable_variant_object()
+                                         ("source", source)
+                                         ("lang", "painless")
+                                         ("params", fields)) );
+   json.pop_back(); // }
+   json.append( ",\"upsert\":" );
+   json.append( upsert_json );
+   json.push_back( '}' );
+   return json;
+}
 
-   if( !include ) { return false; }
-   if( filter_out.empty() ) { return true; }
+/// @return the number of traces in the tree of atrace, atrace included
+size_t count_action_traces( const chain::action_trace& atrace ) {
+   size_t count = 1;
+   for( const auto& inline_trace : atrace.inline_traces ) {
+      count += count_action_traces( inline_trace );
+   }
+   return count;
+}
 
-   auto itr = std::find_if( filter_out.cbegin(), filter_out.cend(), [&receiver, &act_name]( const auto& filter ) {
-      return filter.match( receiver, act_name, 0 );
-   } );
-   if( itr != filter_out.cend() ) { return false; }
+/// @return the approximate memory held by a queued entry, charged to the memory budget
+size_t approx_size( const chain::action_trace& atrace ) {
+   size_t size = sizeof(atrace) + atrace.act.data.size() + atrace.console.size();
+   for( const auto& inline_trace : atrace.inline_traces ) {
+      size += approx_size( inline_trace );
+   }
+   return size;
+}
 
-   for( const auto& a : authorization ) {
-      auto itr = std::find_if( filter_out.cbegin(), filter_out.cend(), [&receiver, &act_name, &a]( const auto& filter ) {
-         return filter.match( receiver, act_name, a.actor );
-      } );
-      if( itr != filter_out.cend() ) { return false; }
+size_t approx_size( const chain::transaction_trace_ptr& t ) {
+   size_t size = sizeof(*t);
+   for( const auto& atrace : t->action_traces ) {
+      size += approx_size( atrace );
    }
+   return size;
+}
 
-   return true;
+size_t approx_size( const chain::transaction_metadata_ptr& t ) {
+   const auto& trx = t->packed_trx;
+   return sizeof(*t) + trx->get_unprunable_size() + trx->get_prunable_size();
 }
 
-bool elasticsearch_plugin_impl::filter_include( const transaction& trx ) const
-{
-   if( !filter_on_star || !filter_out.empty() ) {
-      bool include = false;
-      for( const auto& a : trx.actions ) {
-         if( filter_include( a.account, a.name, a.authorization ) ) {
-            include = true;
-            break;
-         }
-      }
-      if( !include ) {
-         for( const auto& a : trx.context_free_actions ) {
-            if( filter_include( a.account, a.name, a.authorization ) ) {
-               include = true;
-               break;
-            }
-         }
-      }
-      return include;
+size_t approx_size( const chain::block_state_ptr& bs ) {
+   return sizeof(*bs) + fc::raw::pack_size( *bs->block );
+}
+
+size_t approx_size( const block_table_deltas_ptr& deltas ) {
+   size_t size = sizeof(*deltas);
+   for( const auto& row : deltas->rows ) {
+      size += sizeof(row) + row.value.size();
    }
-   return true;
+   return size;
+}
+
 }
 
+static appbase::abstract_plugin& _elasticsearch_plugin = app().register_plugin<elasticsearch_plugin>();
+
+const action_name elasticsearch_plugin_impl::newaccount = chain::newaccount::get_name();
+const action_name elasticsearch_plugin_impl::setabi = chain::setabi::get_name();
+const action_name elasticsearch_plugin_impl::updateauth = chain::updateauth::get_name();
+const action_name elasticsearch_plugin_impl::deleteauth = chain::deleteauth::get_name();
+const action_name elasticsearch_plugin_impl::transfer = N(transfer);
+const permission_name elasticsearch_plugin_impl::owner = chain::config::owner_name;
+const permission_name elasticsearch_plugin_impl::active = chain::config::active_name;
+
+
 elasticsearch_plugin_impl::elasticsearch_plugin_impl()
 {
+   block_states_fields.exclude( "block" );
 }
 
 elasticsearch_plugin_impl::~elasticsearch_plugin_impl()
@@ -259,25 +172,23 @@ elasticsearch_plugin_impl::~elasticsearch_plugin_impl()
 
 template<typename Queue, typename Entry>
 void elasticsearch_plugin_impl::queue( Queue& queue, const Entry& e ) {
-   std::unique_lock<std::mutex> lock( mtx );
-   auto queue_size = queue.size();
-   if( queue_size > max_queue_size ) {
-      lock.unlock();
-      condition.notify_one();
-      queue_sleep_time += 10;
-      if( queue_sleep_time > 1000 )
-         wlog("queue size: ${q}", ("q", queue_size));
-      std::this_thread::sleep_for( std::chrono::milliseconds( queue_sleep_time ));
-      lock.lock();
-   } else {
-      queue_sleep_time -= 10;
-      if( queue_sleep_time < 0 ) queue_sleep_time = 0;
+   memory_credit_ptr credit;
+   if( budget ) {
+      // blocks the signal until the pipeline has drained enough to make room for e
+      credit = budget->acquire( approx_size( e ) );
    }
-   queue.emplace_back( e );
+   std::unique_lock<std::mutex> lock( mtx );
+   queue.emplace_back( e, std::move( credit ) );
    lock.unlock();
    condition.notify_one();
 }
 
+template<typename Task>
+void elasticsearch_plugin_impl::enqueue_task( size_t bytes, Task&& task ) {
+   // the task holds the credit of the entry it was created from until its documents are in a bulk body
+   worker_pool->enqueue( bytes, [ task{std::forward<Task>(task)}, credit{current_credit} ]() mutable { task(); } );
+}
+
 void elasticsearch_plugin_impl::accepted_transaction( const chain::transaction_metadata_ptr& t ) {
    try {
       if( store_transactions ) {
@@ -329,7 +240,12 @@ void elasticsearch_plugin_impl::applied_transaction( const chain::transaction_tr
 
 void elasticsearch_plugin_impl::applied_irreversible_block( const chain::block_state_ptr& bs ) {
    try {
-      if( store_blocks || store_block_states || store_transactions ) {
+      if( irreversible_only ) {
+         if( !start_block_reached && bs->block_num >= start_block_num ) {
+            start_block_reached = true;
+         }
+         queue( irreversible_block_state_queue, bs );
+      } else if( store_blocks || store_block_states || store_transactions || fork_handling != fork_handling_type::none ) {
          queue( irreversible_block_state_queue, bs );
       }
    } catch (fc::exception& e) {
@@ -343,12 +259,26 @@ void elasticsearch_plugin_impl::applied_irreversible_block( const chain::block_s
 
 void elasticsearch_plugin_impl::accepted_block( const chain::block_state_ptr& bs ) {
    try {
+      if( !table_contracts.empty() ) {
+         // the undo session of bs is only available while the signal is emitted
+         auto deltas = capture_table_deltas( *chain_db, bs, table_contracts );
+         if( deltas && !deltas->rows.empty() ) {
+            queue( table_deltas_queue, deltas );
+         }
+      }
+      if( irreversible_only ) {
+         // only needed to age out buffered accepted transactions
+         if( store_transactions ) {
+            queue( block_state_queue, bs );
+         }
+         return;
+      }
       if( !start_block_reached ) {
          if( bs->block_num >= start_block_num ) {
             start_block_reached = true;
          }
       }
-      if( store_blocks || store_block_states ) {
+      if( store_blocks || store_block_states || fork_handling != fork_handling_type::none ) {
          queue( block_state_queue, bs );
       }
    } catch (fc::exception& e) {
@@ -363,7 +293,13 @@ void elasticsearch_plugin_impl::accepted_block( const chain::block_state_ptr& bs
 void elasticsearch_plugin_impl::process_accepted_transaction( chain::transaction_metadata_ptr t ) {
    try {
       if( start_block_reached ) {
-         _process_accepted_transaction( std::move(t) );
+         if( irreversible_only ) {
+            const auto id = t->id;
+            reversible_trxs[id] = budgeted<chain::transaction_metadata_ptr>( std::move(t), retain_current_credit() );
+            reversible_trxs_order.emplace_back( pending_block_num, id );
+         } else {
+            _process_accepted_transaction( std::move(t) );
+         }
       }
    } catch (fc::exception& e) {
       elog("FC Exception while processing accepted transaction metadata: ${e}", ("e", e.to_detail_string()));
@@ -376,6 +312,12 @@ void elasticsearch_plugin_impl::process_accepted_transaction( chain::transaction
 
 void elasticsearch_plugin_impl::process_applied_transaction( chain::transaction_trace_ptr t ) {
    try {
+      if( irreversible_only ) {
+         // processed once the block becomes irreversible, see _process_final_block
+         auto& traces = reversible_traces[t->block_num][*t->producer_block_id];
+         traces.emplace_back( std::move(t), retain_current_credit() );
+         return;
+      }
       // always call since we need to capture setabi on accounts even if not storing transaction traces
       _process_applied_transaction( std::move(t) );
    } catch (fc::exception& e) {
@@ -387,11 +329,32 @@ void elasticsearch_plugin_impl::process_applied_transaction( chain::transaction_
    }
 }
 
+void elasticsearch_plugin_impl::process_table_deltas( block_table_deltas_ptr deltas ) {
+   try {
+      if( irreversible_only || start_block_reached ) {
+         // written once the block is irreversible, dropped if the block is orphaned
+         auto& buffered = reversible_table_deltas[deltas->block_num][deltas->block_id];
+         buffered = budgeted<block_table_deltas_ptr>( std::move(deltas), retain_current_credit() );
+      }
+   } catch (fc::exception& e) {
+      elog("FC Exception while processing table deltas: ${e}", ("e", e.to_detail_string()));
+   } catch (std::exception& e) {
+      elog("STD Exception while processing table deltas: ${e}", ("e", e.what()));
+   } catch (...) {
+      elog("Unknown exception while processing table deltas");
+   }
+}
+
 void elasticsearch_plugin_impl::process_irreversible_block( chain::block_state_ptr bs) {
   try {
-     if( start_block_reached ) {
+     if( irreversible_only ) {
+        _process_final_block( std::move(bs) );
+     } else if( start_block_reached ) {
         _process_irreversible_block( std::move(bs) );
      }
+     if( query && checkpoint ) {
+        query->set_settled_block( checkpoint->acknowledged() );
+     }
   } catch (fc::exception& e) {
      elog("FC Exception while processing irreversible block: ${e}", ("e", e.to_detail_string()));
   } catch (std::exception& e) {
@@ -403,6 +366,8 @@ void elasticsearch_plugin_impl::process_irreversible_block( chain::block_state_p
 
 void elasticsearch_plugin_impl::process_accepted_block( chain::block_state_ptr bs ) {
    try {
+      pending_block_num = bs->block_num + 1;
+      if( irreversible_only ) return;
       if( start_block_reached ) {
          _process_accepted_block( std::move(bs) );
       }
@@ -421,35 +386,37 @@ void elasticsearch_plugin_impl::create_new_account(
 {
    fc::variants pub_keys;
    fc::variants account_controls;
+   const auto owner_str = name_string( owner );
+   const auto active_str = name_string( active );
 
-   param_doc("name", newacc.name.to_string());
-   param_doc("creator", newacc.creator.to_string());
+   param_doc("name", name_string( newacc.name ));
+   param_doc("creator", name_string( newacc.creator ));
    param_doc("account_create_time", block_time);
 
    for( const auto& account : newacc.owner.accounts ) {
       fc::mutable_variant_object account_entry;
-      account_entry( "permission", owner.to_string());
-      account_entry( "name", account.permission.actor.to_string());
+      account_entry( "permission", owner_str);
+      account_entry( "name", name_string( account.permission.actor ));
       account_controls.emplace_back(account_entry);
    }
 
    for( const auto& account : newacc.active.accounts ) {
       fc::mutable_variant_object account_entry;
-      account_entry( "permission", active.to_string());
-      account_entry( "name", account.permission.actor.to_string());
+      account_entry( "permission", active_str);
+      account_entry( "name", name_string( account.permission.actor ));
       account_controls.emplace_back(account_entry);
    }
 
    for( const auto& pub_key_weight : newacc.owner.keys ) {
       fc::mutable_variant_object key_entry;
-      key_entry( "permission", owner.to_string());
+      key_entry( "permission", owner_str);
       key_entry( "key", pub_key_weight.key.operator string());
       pub_keys.emplace_back(key_entry);
    }
 
    for( const auto& pub_key_weight : newacc.active.keys ) {
       fc::mutable_variant_object key_entry;
-      key_entry( "permission", active.to_string());
+      key_entry( "permission", active_str);
       key_entry( "key", pub_key_weight.key.operator string());
       pub_keys.emplace_back(key_entry);
    }
@@ -463,22 +430,23 @@ void elasticsearch_plugin_impl::update_account_auth(
 {
    fc::variants pub_keys;
    fc::variants account_controls;
+   const auto permission = name_string( update.permission );
 
    for( const auto& pub_key_weight : update.auth.keys ) {
       fc::mutable_variant_object key_entry;
-      key_entry( "permission", update.permission.to_string());
+      key_entry( "permission", permission);
       key_entry( "key", pub_key_weight.key.operator string());
       pub_keys.emplace_back(key_entry);
    }
 
    for( const auto& account : update.auth.accounts ) {
       fc::mutable_variant_object account_entry;
-      account_entry( "permission", update.permission.to_string());
-      account_entry( "name", account.permission.actor.to_string());
+      account_entry( "permission", permission);
+      account_entry( "name", name_string( account.permission.actor ));
       account_controls.emplace_back(account_entry);
    }
 
-   param_doc("permission", update.permission.to_string());
+   param_doc("permission", permission);
    param_doc("pub_keys", pub_keys);
    param_doc("account_controls", account_controls);
 }
@@ -486,7 +454,7 @@ void elasticsearch_plugin_impl::update_account_auth(
 void elasticsearch_plugin_impl::delete_account_auth(
    fc::mutable_variant_object& param_doc, const chain::deleteauth& del)
 {
-   param_doc("permission", del.permission.to_string());
+   param_doc("permission", name_string( del.permission ));
 }
 
 void elasticsearch_plugin_impl::upsert_account_setabi(
@@ -496,10 +464,43 @@ void elasticsearch_plugin_impl::upsert_account_setabi(
 
    serializer->upsert_abi_cache( setabi.account, abi_def );
 
-   param_doc("name", setabi.account.to_string());
+   param_doc("name", name_string( setabi.account ));
    param_doc("abi", abi_def);
 }
 
+void elasticsearch_plugin_impl::index_transfer( const chain::base_action_trace& atrace )
+{
+   token_transfer tt;
+   try {
+      tt = atrace.act.data_as<token_transfer>();
+   } catch( fc::exception& e ) {
+      // not a standard token transfer, skip it
+      return;
+   }
+
+   fc::mutable_variant_object transfer_doc;
+   transfer_doc("contract", name_string( atrace.act.account ));
+   transfer_doc("from", name_string( tt.from ));
+   transfer_doc("to", name_string( tt.to ));
+   transfer_doc("quantity", tt.quantity.to_string());
+   transfer_doc("amount", tt.quantity.to_real());
+   transfer_doc("symbol", tt.quantity.get_symbol().name());
+   transfer_doc("precision", tt.quantity.decimals());
+   transfer_doc("memo", tt.memo);
+   transfer_doc("global_sequence", atrace.receipt.global_sequence);
+   transfer_doc("trx_id", to_hex_string( atrace.trx_id ));
+   transfer_doc("block_num", static_cast<int32_t>(atrace.block_num));
+   transfer_doc("block_time", atrace.block_time);
+   // matched by the cleanup of orphaned blocks
+   if( atrace.producer_block_id ) transfer_doc("producer_block_id", to_hex_string( *atrace.producer_block_id ));
+
+   auto action = bulk_action( "index", transfers_index, atrace.receipt.global_sequence );
+   auto json = to_json( transfer_doc );
+
+   bulker& bulk = bulk_pool->get();
+   bulk.append_document(std::move(action), std::move(json), atrace.block_num);
+}
+
 void elasticsearch_plugin_impl::upsert_account(
       std::unordered_map<uint64_t, std::pair<std::string, fc::mutable_variant_object>> &account_upsert_actions,
       const chain::action& act, const chain::block_timestamp_type& block_time )
@@ -579,109 +580,157 @@ void elasticsearch_plugin_impl::_process_applied_transaction( chain::transaction
 
    std::unordered_map<uint64_t, std::pair<std::string, fc::mutable_variant_object>> account_upsert_actions;
    std::vector<std::reference_wrapper<chain::base_action_trace>> base_action_traces; // without inline action traces
+   std::vector<action_trace_position> positions; // parallel to base_action_traces if enrich_action_traces
+   std::vector<std::reference_wrapper<chain::base_action_trace>> transfer_traces;
+
+   const bool executed = t->receipt.valid() && t->receipt->status == chain::transaction_receipt_header::executed;
+   // decided once per transaction instead of once per trace
+   const bool reached = start_block_reached;
+   const bool include_all = filter.include_all();
+   const bool find_transfers = store_transfers && executed && reached;
+
+   size_t total_traces = 0;
+   for( const auto& atrace : t->action_traces ) {
+      total_traces += count_action_traces( atrace );
+   }
+   if( reached ) {
+      base_action_traces.reserve( total_traces );
+      if( enrich_action_traces ) positions.reserve( total_traces );
+   }
 
-   bool executed = t->receipt.valid() && t->receipt->status == chain::transaction_receipt_header::executed;
-
-   std::stack<std::reference_wrapper<chain::action_trace>> stack;
-   for( auto& atrace : t->action_traces ) {
-      stack.emplace(atrace);
-
-      while ( !stack.empty() )
-      {
-         auto &atrace = stack.top().get();
-         stack.pop();
+   uint32_t ordinal = 0;
+   auto visit = [&]( chain::action_trace& atrace, uint32_t creator_ordinal, const chain::action_trace* creator ) {
+      const auto action_ordinal = ++ordinal;
 
-         if( executed && atrace.receipt.receiver == chain::config::system_account_name ) {
-            upsert_account( account_upsert_actions, atrace.act, atrace.block_time );
-         }
+      if( executed && atrace.receipt.receiver == chain::config::system_account_name ) {
+         upsert_account( account_upsert_actions, atrace.act, atrace.block_time );
+      }
 
-         if( start_block_reached && filter_include( atrace.receipt.receiver, atrace.act.name, atrace.act.authorization ) ) {
-            base_action_traces.emplace_back( atrace );
+      if( reached && (include_all || filter_include( atrace.receipt.receiver, atrace.act.name, atrace.act.authorization )) ) {
+         base_action_traces.emplace_back( atrace );
+         if( enrich_action_traces ) {
+            positions.push_back( action_trace_position{action_ordinal, creator_ordinal, creator} );
          }
+      }
 
-         auto &inline_traces = atrace.inline_traces;
-         for( auto it = inline_traces.rbegin(); it != inline_traces.rend(); ++it ) {
-            stack.emplace(*it);
+      // only the contract's own receipt, notifications of from and to repeat the same transfer
+      if( find_transfers && atrace.act.name == transfer &&
+          atrace.receipt.receiver == atrace.act.account && transfer_contracts.count( atrace.act.account ) ) {
+         transfer_traces.emplace_back( atrace );
+      }
+      return action_ordinal;
+   };
+
+   // one frame per level of inline actions, which the chain limits to a few, so the stack stays inline
+   struct frame {
+      chain::action_trace* parent;
+      uint32_t parent_ordinal;
+      size_t next_child;
+   };
+   boost::container::small_vector<frame, 8> stack;
+   for( auto& atrace : t->action_traces ) {
+      const auto action_ordinal = visit( atrace, 0, nullptr );
+      if( !atrace.inline_traces.empty() ) stack.push_back( frame{&atrace, action_ordinal, 0} );
+
+      while( !stack.empty() ) {
+         auto& top = stack.back();
+         if( top.next_child == top.parent->inline_traces.size() ) {
+            stack.pop_back();
+            continue;
          }
+         auto* parent = top.parent;
+         auto& child = parent->inline_traces[top.next_child++];
+         const auto child_ordinal = visit( child, top.parent_ordinal, parent );
+         if( !child.inline_traces.empty() ) stack.push_back( frame{&child, child_ordinal, 0} );
       }
    }
 
-   if ( !account_upsert_actions.empty() ) {
+   const auto block_num = t->block_num;
+   const auto trace_bytes = approx_size( t ); // pinned by every task capturing t
 
-      auto f =  [ account_upsert_actions{std::move(account_upsert_actions)}, this ]()
-      {
-         elasticlient::SameIndexBulkData bulk_account_upserts(accounts_index);
-         for( auto& action : account_upsert_actions ) {
-
-            fc::mutable_variant_object source_doc;
-            fc::mutable_variant_object script_doc;
-
-            script_doc("lang", "painless");
-            script_doc("source", action.second.first);
-            script_doc("params", action.second.second);
-
-            source_doc("scripted_upsert", true);
-            source_doc("upsert", fc::variant_object());
-            source_doc("script", script_doc);
-
-            auto id = std::to_string(action.first);
-            auto json = fc::json::to_string(source_doc);
-
-            bulk_account_upserts.updateDocument("_doc", id, json);
-         }
-
-         try {
-            es_client->bulk_perform(bulk_account_upserts);
-         } catch( ... ) {
-            handle_elasticsearch_exception( "upsert accounts " + bulk_account_upserts.body(), __LINE__ );
-         }
-      };
+   if ( !account_upsert_actions.empty() ) {
 
-      upsert_account_task_queue.emplace( std::move(f) );
+      checkpoint_begin( block_num );
+      account_upserts upserts;
+      upserts.block_num = block_num;
+      upserts.actions = std::move( account_upsert_actions );
+      // the upserts hold the params of the actions, setabi ones the whole abi
+      upserts.credit = current_credit;
+      account_lane->push( std::move(upserts) );
+   }
 
-      check_task_queue_size();
-      thread_pool->enqueue(
-         [ this ]()
+   if( !transfer_traces.empty() ) {
+      checkpoint_begin( block_num );
+      enqueue_task( trace_bytes,
+         [ t, transfer_traces{std::move(transfer_traces)}, block_num, this ]()
          {
-            std::unique_lock<std::mutex> guard(upsert_account_task_mtx);
-            std::function<void()> task = std::move( upsert_account_task_queue.front() );
-            task();
-            upsert_account_task_queue.pop();
+            auto end_guard = fc::make_scoped_exit( [&]() { checkpoint_end( block_num ); } );
+            for( auto& atrace : transfer_traces ) {
+               index_transfer( atrace.get() );
+            }
          }
       );
-
    }
 
    if( base_action_traces.empty() ) return; //< do not index transaction_trace if all action_traces filtered out
-   check_task_queue_size();
-   thread_pool->enqueue(
-      [ t{std::move(t)}, base_action_traces{std::move(base_action_traces)}, this ]()
-      {
-         const auto& trx_id = t->id;
-         const auto trx_id_str = trx_id.str();
-         if ( store_action_traces ) {
-            for (auto& atrace : base_action_traces) {
-               fc::mutable_variant_object action_traces_doc;
-               chain::base_action_trace &base = atrace.get();
-               fc::from_variant( serializer->to_variant_with_abi( base ), action_traces_doc );
-
-               fc::mutable_variant_object act_doc;
-               fc::from_variant( action_traces_doc["act"], act_doc );
-               act_doc["data"] = fc::json::to_string( act_doc["data"] );
 
-               action_traces_doc["act"] = act_doc;
-
-               fc::mutable_variant_object action_doc;
-               action_doc("_index", action_traces_index);
-               action_doc("_type", "_doc");
-               action_doc("_id", base.receipt.global_sequence);
-               action_doc("retry_on_conflict", 100);
+   auto selected = std::make_shared<selected_action_traces>();
+   selected->traces = std::move( base_action_traces );
+   selected->positions = std::move( positions );
+   const size_t count = selected->traces.size();
+
+   if( store_action_traces ) {
+      // a transaction with thousands of inline actions is decoded by several workers instead of one
+      for( size_t begin = 0; begin < count; begin += action_traces_chunk_size ) {
+         const size_t end = std::min( count, begin + action_traces_chunk_size );
+         checkpoint_begin( block_num );
+         enqueue_task( std::max<size_t>( 1, trace_bytes * (end - begin) / count ),
+            [ t, selected, begin, end, block_num, this ]()
+            {
+               auto end_guard = fc::make_scoped_exit( [&]() { checkpoint_end( block_num ); } );
+               try {
+                  index_action_traces( *t, *selected, begin, end );
+               } catch( ... ) {
+                  // e.g. the partition index could not be created, the traces of the chunk are missing
+                  end_guard.cancel();
+                  checkpoint_fail( block_num );
+                  throw;
+               }
+            }
+         );
+      }
+   }
 
-               auto action = fc::json::to_string( fc::variant_object("index", action_doc) );
-               auto json = fc::prune_invalid_utf8( fc::json::to_string(action_traces_doc) );
+   if( !store_account_actions && !store_transaction_traces ) return;
+   checkpoint_begin( block_num );
+   enqueue_task( trace_bytes,
+      [ t{std::move(t)}, selected{std::move(selected)}, block_num, this ]()
+      {
+         auto end_guard = fc::make_scoped_exit( [&]() { checkpoint_end( block_num ); } );
+         const auto trx_id_str = to_hex_string( t->id );
+
+         if( store_account_actions ) {
+            // every notified account has its own receipt, so one row per trace covers each account once
+            for( auto& atrace : selected->traces ) {
+               const chain::base_action_trace& base = atrace.get();
+               const auto account = name_string( base.receipt.receiver );
+
+               fc::mutable_variant_object account_action_doc;
+               account_action_doc("account", account);
+               account_action_doc("global_sequence", base.receipt.global_sequence);
+               account_action_doc("block_num", static_cast<int32_t>(base.block_num));
+               account_action_doc("block_time", base.block_time);
+               account_action_doc("contract", name_string( base.act.account ));
+               account_action_doc("action", name_string( base.act.name ));
+               account_action_doc("trx_id", trx_id_str);
+               // matched by the cleanup of orphaned blocks
+               if( base.producer_block_id ) account_action_doc("producer_block_id", to_hex_string( *base.producer_block_id ));
+
+               auto action = bulk_action( "index", account_actions_index, base.receipt.global_sequence, 0, account );
+               auto json = to_json( account_action_doc );
 
                bulker& bulk = bulk_pool->get();
-               bulk.append_document(std::move(action), std::move(json));
+               bulk.append_document(std::move(action), std::move(json), block_num);
             }
          }
 
@@ -689,19 +738,13 @@ void elasticsearch_plugin_impl::_process_applied_transaction( chain::transaction
             // transaction trace index
 
             fc::mutable_variant_object trans_traces_doc;
-            fc::from_variant( serializer->to_variant_with_abi( *t ), trans_traces_doc );
-
-            fc::mutable_variant_object action_doc;
-            action_doc("_index", trans_traces_index);
-            action_doc("_type", "_doc");
-            action_doc("_id", trx_id_str);
-            action_doc("retry_on_conflict", 100);
+            fc::from_variant( project_with_abi( *t, trans_traces_fields ), trans_traces_doc );
 
-            auto action = fc::json::to_string( fc::variant_object("index", action_doc) );
-            auto json = fc::prune_invalid_utf8( fc::json::to_string( trans_traces_doc ) );
+            auto action = bulk_action( "index", trans_traces_index, trx_id_str, 100 );
+            auto json = to_json( trans_traces_doc );
 
             bulker& bulk = bulk_pool->get();
-            bulk.append_document(std::move(action), std::move(json));
+            bulk.append_document(std::move(action), std::move(json), block_num);
 
          }
       }
@@ -709,198 +752,286 @@ void elasticsearch_plugin_impl::_process_applied_transaction( chain::transaction
 
 }
 
+void elasticsearch_plugin_impl::index_action_traces( const chain::transaction_trace& t, const selected_action_traces& selected,
+                                                     size_t begin, size_t end ) {
+   for( size_t i = begin; i < end; ++i ) {
+      fc::mutable_variant_object action_traces_doc;
+      const chain::base_action_trace& base = selected.traces[i].get();
+      fc::from_variant( project_with_abi( base, action_traces_fields ), action_traces_doc );
+
+      auto act_itr = action_traces_doc.find( "act" );
+      if( act_itr != action_traces_doc.end() ) {
+         fc::mutable_variant_object act_doc;
+         fc::from_variant( act_itr->value(), act_doc );
+         act_doc["data"] = to_json( act_doc["data"] );
+
+         action_traces_doc["act"] = act_doc;
+      }
+
+      if( enrich_action_traces ) {
+         // trx_id, block_num, block_time and producer_block_id are part of every action trace
+         const auto& position = selected.positions[i];
+         action_traces_doc("action_ordinal", position.action_ordinal);
+         action_traces_doc("creator_action_ordinal", position.creator_action_ordinal);
+         if( position.creator ) {
+            action_traces_doc("creator_global_sequence", position.creator->receipt.global_sequence);
+            action_traces_doc("creator_action", fc::mutable_variant_object()
+                                                  ("account", position.creator->act.account)
+                                                  ("name", position.creator->act.name));
+         }
+         action_traces_doc("scheduled", t.scheduled);
+      }
+
+      auto action = bulk_action( "index", action_traces_router->get( base.block_num, base.block_time ),
+                                 base.receipt.global_sequence, 100,
+                                 route_action_traces ? name_string( base.receipt.receiver ) : std::string() );
+      auto json = to_json( action_traces_doc );
+
+      bulker& bulk = bulk_pool->get();
+      bulk.append_document(std::move(action), std::move(json), t.block_num);
+   }
+}
+
+fc::mutable_variant_object elasticsearch_plugin_impl::transaction_doc( const chain::transaction_metadata_ptr& t ) {
+   const signed_transaction& trx = t->packed_trx->get_signed_transaction();
+
+   fc::variant signing_keys;
+   if( t->signing_keys_future.wait_for(std::chrono::seconds(0)) == std::future_status::ready ) {
+      signing_keys = std::get<2>(t->signing_keys_future.get());
+   } else {
+      flat_set<public_key_type> keys;
+      trx.get_signature_keys( *chain_id, fc::time_point::maximum(), keys, false );
+      signing_keys = keys;
+   }
+
+   return make_transaction_doc( *serializer, trans_fields, trx, t->id, signing_keys, t->accepted, t->implicit, t->scheduled );
+}
+
 void elasticsearch_plugin_impl::_process_accepted_transaction( chain::transaction_metadata_ptr t ) {
-   check_task_queue_size();
-   thread_pool->enqueue(
-      [ t{std::move(t)}, this ]()
+   const auto block_num = pending_block_num;
+   checkpoint_begin( block_num );
+   enqueue_task( approx_size( t ),
+      [ t{std::move(t)}, block_num, this ]()
       {
+         auto end_guard = fc::make_scoped_exit( [&]() { checkpoint_end( block_num ); } );
          const signed_transaction& trx = t->packed_trx->get_signed_transaction();
          if( !filter_include( trx ) ) return;
 
-         const auto& trx_id = t->id;
-         const auto trx_id_str = trx_id.str();
+         const auto trx_id_str = to_hex_string( t->id );
 
-         fc::mutable_variant_object trans_doc;
          fc::mutable_variant_object doc;
 
-         fc::from_variant( serializer->to_variant_with_abi( trx ), trans_doc );
-         trans_doc("trx_id", trx_id_str);
+         doc("doc", transaction_doc( t ));
+         doc("doc_as_upsert", true);
 
-         fc::variant signing_keys;
-         if( t->signing_keys_future.wait_for(std::chrono::seconds(0)) == std::future_status::ready ) {
-            signing_keys = std::get<2>(t->signing_keys_future.get());
-         } else {
-            flat_set<public_key_type> keys;
-            trx.get_signature_keys( *chain_id, fc::time_point::maximum(), keys, false );
-            signing_keys = keys;
-         }
+         auto action = bulk_action( "update", trans_index, trx_id_str, 100 );
+         auto json = to_json( doc );
 
-         if( !signing_keys.is_null() ) {
-            trans_doc("signing_keys", signing_keys);
-         }
+         bulker& bulk = bulk_pool->get();
+         bulk.append_document(std::move(action), std::move(json), block_num);
+      }
+   );
+}
 
-         trans_doc("accepted", t->accepted);
-         trans_doc("implicit", t->implicit);
-         trans_doc("scheduled", t->scheduled);
+void elasticsearch_plugin_impl::_process_table_deltas( block_table_deltas_ptr deltas ) {
+   checkpoint_begin( deltas->block_num );
+   enqueue_task( approx_size( deltas ),
+      [ deltas{std::move(deltas)}, this ]()
+      {
+         const auto block_num = deltas->block_num;
+         const auto block_id_str = to_hex_string( deltas->block_id );
+         auto end_guard = fc::make_scoped_exit( [&]() { checkpoint_end( block_num ); } );
+
+         for( const auto& row : deltas->rows ) {
+            std::string row_id;
+            row_id.reserve( 3 * 14 + 20 );
+            append_name( row_id, row.code );
+            row_id.push_back( '-' );
+            append_name( row_id, row.scope );
+            row_id.push_back( '-' );
+            append_name( row_id, row.table );
+            row_id.push_back( '-' );
+            append_uint( row_id, row.primary_key );
+
+            fc::mutable_variant_object row_doc;
+            row_doc("code", name_string( row.code ));
+            row_doc("scope", name_string( row.scope ));
+            row_doc("table", name_string( row.table ));
+            row_doc("primary_key", std::to_string(row.primary_key));
+            row_doc("payer", name_string( row.payer ));
+            row_doc("block_num", static_cast<int32_t>(block_num));
+            row_doc("block_time", deltas->block_time);
+            if( row.present ) {
+               // stored as a string like act.data to avoid a mapping per contract table
+               auto data = serializer->table_row_to_variant( row.code, row.table, row.value );
+               if( data.is_null() ) {
+                  row_doc("hex_data", row.value);
+               } else {
+                  row_doc("data", to_json( data ));
+               }
+            }
 
-         doc("doc", trans_doc);
-         doc("doc_as_upsert", true);
+            {
+               std::string action;
+               std::string json;
+               if( row.present ) {
+                  action = bulk_action( "index", table_rows_index, row_id );
+                  json = to_json( row_doc );
+               } else {
+                  action = bulk_action( "delete", table_rows_index, row_id );
+               }
+
+               bulker& bulk = bulk_pool->get();
+               bulk.append_document(std::move(action), std::move(json), block_num);
+            }
 
-         fc::mutable_variant_object action_doc;
-         action_doc("_index", trans_index);
-         action_doc("_type", "_doc");
-         action_doc("_id", trx_id_str);
-         action_doc("retry_on_conflict", 100);
+            row_doc("present", row.present);
+            row_doc("block_id", block_id_str);
 
-         auto action = fc::json::to_string( fc::variant_object("update", action_doc) );
-         auto json = fc::prune_invalid_utf8( fc::json::to_string( doc ) );
+            auto action = bulk_action( "index", table_deltas_index, std::to_string(block_num) + "-" + row_id );
+            auto json = to_json( row_doc );
 
-         bulker& bulk = bulk_pool->get();
-         bulk.append_document(std::move(action), std::move(json));
+            bulker& bulk = bulk_pool->get();
+            bulk.append_document(std::move(action), std::move(json), block_num);
+         }
       }
    );
 }
 
 void elasticsearch_plugin_impl::_process_accepted_block( chain::block_state_ptr bs ) {
-   check_task_queue_size();
-   thread_pool->enqueue(
+   if( fork_handling != fork_handling_type::none ) {
+      reversible_block_ids[bs->block_num].push_back( bs->id );
+   }
+   checkpoint_begin( bs->block_num );
+   enqueue_task( approx_size( bs ),
       [ bs{std::move(bs)}, this ]()
       {
          auto block_num = bs->block_num;
+         auto end_guard = fc::make_scoped_exit( [&]() { checkpoint_end( block_num ); } );
          if( block_num % 10000 == 0 )
             ilog( "block_num: ${b}", ("b", block_num) );
 
          const auto block_id = bs->id;
-         const auto block_id_str = block_id.str();
-
-         if( store_block_states ) {
-            auto source = "int v;"; // Do nothing if document already exsit.
-
-            fc::mutable_variant_object doc;
-            fc::mutable_variant_object bs_doc(bs);
-            fc::mutable_variant_object script_doc;
+         const auto block_id_str = to_hex_string( block_id );
 
-            bs_doc.erase("block");
-            script_doc("source", source);
-            script_doc("lang", "painless");
+         if( !store_block_states && !store_blocks ) return;
 
-            doc("script", script_doc);
-            doc("scripted_upsert", true);
-            doc("upsert", bs_doc);
+         // reused by the irreversible update, which only patches the fields changing until then
+         auto docs = make_block_docs( bs );
+         block_docs_cache.put( block_num, block_id, docs );
 
-            fc::mutable_variant_object action_doc;
-            action_doc("_index", block_states_index);
-            action_doc("_type", "_doc");
-            action_doc("_id", block_id_str);
-            action_doc("retry_on_conflict", 100);
-
-            auto action = fc::json::to_string( fc::variant_object("update", action_doc) );
-            auto json = fc::prune_invalid_utf8( fc::json::to_string( doc ) );
+         if( store_block_states ) {
+            auto action = bulk_action( "update", block_states_index, block_id_str, 100 );
+            auto json = accepted_block_state_source( *docs, bs );
 
             bulker& bulk = bulk_pool->get();
-            bulk.append_document(std::move(action), std::move(json));
+            bulk.append_document(std::move(action), std::move(json), block_num);
          }
 
          if( store_blocks ) {
-            auto source = "int v;"; // Do nothing if document already exsit.
-
-            fc::mutable_variant_object doc;
-            fc::mutable_variant_object block_doc;
-            fc::mutable_variant_object script_doc;
-
-            fc::from_variant(serializer->to_variant_with_abi( *bs->block ), block_doc);
-
-            script_doc("source", source);
-            script_doc("lang", "painless");
-
-            doc("script", script_doc);
-            doc("scripted_upsert", true);
-            doc("upsert", block_doc);
-
-            fc::mutable_variant_object action_doc;
-            action_doc("_index", blocks_index);
-            action_doc("_type", "_doc");
-            action_doc("_id", block_id_str);
-            action_doc("retry_on_conflict", 100);
-
-            auto action = fc::json::to_string( fc::variant_object("update", action_doc) );
-            auto json = fc::prune_invalid_utf8( fc::json::to_string( doc ) );
+            auto action = bulk_action( "update", blocks_index, block_id_str, 100 );
+            auto json = accepted_block_source( *docs );
 
             bulker& bulk = bulk_pool->get();
-            bulk.append_document(std::move(action), std::move(json));
+            bulk.append_document(std::move(action), std::move(json), block_num);
          }
       }
    );
 }
 
-void elasticsearch_plugin_impl::_process_irreversible_block(chain::block_state_ptr bs) {
-   check_task_queue_size();
-   thread_pool->enqueue(
-      [ bs{std::move(bs)}, this ]()
-      {
-         const auto block_id = bs->block->id();
-         const auto block_id_str = block_id.str();
-         const auto block_num = bs->block->block_num();
+std::string elasticsearch_plugin_impl::block_state_json( const chain::block_state_ptr& bs ) {
+   fc::mutable_variant_object bs_doc( project( *bs, block_states_fields, to_plain_variant() ).get_object() );
+   bs_doc.erase( "validated" );
+   bs_doc.erase( "in_current_chain" );
+   return to_json( bs_doc );
+}
 
-         auto source =
-            "ctx._source.validated = params.validated;"
-            "ctx._source.irreversible = params.irreversible;";
+fc::mutable_variant_object elasticsearch_plugin_impl::block_state_fields( const chain::block_state_ptr& bs ) {
+   fc::mutable_variant_object fields;
+   if( block_states_fields.find( "validated" ) ) fields("validated", bs->validated);
+   if( block_states_fields.find( "in_current_chain" ) ) fields("in_current_chain", bs->in_current_chain);
+   return fields;
+}
 
-         fc::mutable_variant_object params_doc;
-         fc::mutable_variant_object script_doc;
+block_docs_ptr elasticsearch_plugin_impl::make_block_docs( const chain::block_state_ptr& bs ) {
+   auto docs = std::make_shared<block_docs>();
+   if( store_block_states ) {
+      docs->block_state = block_state_json( bs );
+   }
+   if( store_blocks ) {
+      auto block_doc = project_with_abi( *bs->block, blocks_fields );
+      docs->block = to_json( block_doc );
+   }
+   return docs;
+}
 
-         params_doc("validated", bs->validated);
-         params_doc("irreversible", true);
+std::string elasticsearch_plugin_impl::accepted_block_state_source( const block_docs& docs,
+                                                                   const chain::block_state_ptr& bs ) {
+   return keep_existing_upsert( json_with_fields( docs.block_state, block_state_fields( bs ) ) );
+}
 
-         script_doc("source", source);
-         script_doc("lang", "painless");
-         script_doc("params", params_doc);
+std::string elasticsearch_plugin_impl::accepted_block_source( const block_docs& docs ) {
+   return keep_existing_upsert( docs.block );
+}
 
-         if( store_block_states ) {
-            fc::mutable_variant_object doc;
-            fc::mutable_variant_object bs_doc(bs);
+void elasticsearch_plugin_impl::_process_irreversible_block(chain::block_state_ptr bs) {
+   if( fork_handling != fork_handling_type::none ) {
+      auto orphans = collect_orphaned_blocks( bs );
+      if( !orphans.empty() ) {
+         // the pool tasks of the orphaned blocks were all enqueued by this thread before, once they have run
+         // every document of those blocks is in a bulker or sent, and the flush of the cleanup sends the rest;
+         // the tasks enqueued meanwhile are not held back
+         worker_pool->enqueue_after(
+            [ orphans{std::move(orphans)}, this ]()
+            {
+               cleanup_orphaned_blocks( orphans );
+            }
+         );
+      }
+   }
 
-            bs_doc.erase("block");
-            bs_doc("irreversible", true);
+   // the rows of a reversible block would stay in table_rows if it were orphaned
+   write_final_table_deltas( bs );
 
-            doc("script", script_doc);
-            doc("upsert", bs_doc);
+   checkpoint_begin( bs->block_num );
+   if( checkpoint ) checkpoint->irreversible( bs->block_num );
+   enqueue_task( approx_size( bs ),
+      [ bs{std::move(bs)}, this ]()
+      {
+         const auto block_id = bs->id;
+         const auto block_id_str = to_hex_string( block_id );
+         const auto block_num = bs->block_num;
+         auto end_guard = fc::make_scoped_exit( [&]() { checkpoint_end( block_num ); } );
+
+         // serialized once when the block was accepted, missing if it was accepted before a restart
+         block_docs_ptr docs;
+         if( store_block_states || store_blocks ) {
+            docs = block_docs_cache.take( block_num, block_id );
+            if( !docs ) docs = make_block_docs( bs );
+         }
 
-            fc::mutable_variant_object action_doc;
-            action_doc("_index", block_states_index);
-            action_doc("_type", "_doc");
-            action_doc("_id", block_id_str);
-            action_doc("retry_on_conflict", 100);
+         if( store_block_states ) {
+            // the fields of an existing document that changed since it was accepted
+            auto fields = block_state_fields( bs );
+            fields("irreversible", true);
 
-            auto action = fc::json::to_string( fc::variant_object("update", action_doc) );
-            auto json = fc::prune_invalid_utf8( fc::json::to_string( doc ) );
+            auto action = bulk_action( "update", block_states_index, block_id_str, 100 );
+            auto json = set_fields_upsert( fields, json_with_fields( docs->block_state, fields ) );
 
             bulker& bulk = bulk_pool->get();
-            bulk.append_document(std::move(action), std::move(json));
+            bulk.append_document(std::move(action), std::move(json), block_num);
          }
 
          if( store_blocks ) {
-            fc::mutable_variant_object doc;
-            fc::mutable_variant_object block_doc;
-
-            fc::from_variant(serializer->to_variant_with_abi( *bs->block ), block_doc);
-            block_doc("irreversible", true);
-            block_doc("validated", bs->validated);
-
-            doc("script", script_doc);
-            doc("upsert", block_doc);
+            fc::mutable_variant_object fields;
+            fields("validated", bs->validated);
+            fields("irreversible", true);
 
-            fc::mutable_variant_object action_doc;
-            action_doc("_index", blocks_index);
-            action_doc("_type", "_doc");
-            action_doc("_id", block_id_str);
-            action_doc("retry_on_conflict", 100);
-
-            auto action = fc::json::to_string( fc::variant_object("update", action_doc) );
-            auto json = fc::prune_invalid_utf8( fc::json::to_string( doc ) );
+            auto action = bulk_action( "update", blocks_index, block_id_str, 100 );
+            auto json = set_fields_upsert( fields, json_with_fields( docs->block, fields ) );
 
             bulker& bulk = bulk_pool->get();
-            bulk.append_document(std::move(action), std::move(json));
+            bulk.append_document(std::move(action), std::move(json), block_num);
          }
 
          if( store_transactions ) {
@@ -914,10 +1045,10 @@ void elasticsearch_plugin_impl::_process_irreversible_block(chain::block_state_p
                   const auto& trx = fc::raw::unpack<transaction>( raw );
                   if( !filter_include( trx ) ) continue;
                   const auto& id = trx.id();
-                  trx_id_str = id.str();
+                  trx_id_str = to_hex_string( id );
                } else {
                   const auto& id = receipt.trx.get<transaction_id_type>();
-                  trx_id_str = id.str();
+                  trx_id_str = to_hex_string( id );
                }
 
                fc::mutable_variant_object trans_doc;
@@ -930,33 +1061,281 @@ void elasticsearch_plugin_impl::_process_irreversible_block(chain::block_state_p
                doc("doc", trans_doc);
                doc("doc_as_upsert", true);
 
-               fc::mutable_variant_object action_doc;
-               action_doc("_index", trans_index);
-               action_doc("_type", "_doc");
-               action_doc("_id", trx_id_str);
-               action_doc("retry_on_conflict", 100);
-
-               auto action = fc::json::to_string( fc::variant_object("update", action_doc) );
-               auto json = fc::prune_invalid_utf8( fc::json::to_string( doc ) );
+               auto action = bulk_action( "update", trans_index, trx_id_str, 100 );
+               auto json = to_json( doc );
 
                bulker& bulk = bulk_pool->get();
-               bulk.append_document(std::move(action), std::move(json));
+               bulk.append_document(std::move(action), std::move(json), block_num);
             }
          }
       }
    );
 }
 
-void elasticsearch_plugin_impl::check_task_queue_size() {
-   auto task_queue_size = thread_pool->queue_size();
-   if ( task_queue_size > max_task_queue_size ) {
-      task_queue_sleep_time += 10;
-      if( task_queue_sleep_time > 1000 )
-         wlog("thread pool task queue size: ${q}", ("q", task_queue_size));
-      std::this_thread::sleep_for( std::chrono::milliseconds( task_queue_sleep_time ));
-   } else {
-      task_queue_sleep_time -= 10;
-      if( task_queue_sleep_time < 0 ) task_queue_sleep_time = 0;
+void elasticsearch_plugin_impl::write_final_table_deltas( const chain::block_state_ptr& bs ) {
+   budgeted<block_table_deltas_ptr> deltas;
+   auto itr = reversible_table_deltas.begin();
+   while( itr != reversible_table_deltas.end() && itr->first <= bs->block_num ) {
+      if( itr->first == bs->block_num ) {
+         auto found = itr->second.find( bs->id );
+         if( found != itr->second.end() ) deltas = std::move( found->second );
+      }
+      itr = reversible_table_deltas.erase( itr );
+   }
+   if( deltas.first && start_block_reached ) {
+      _process_table_deltas( std::move(deltas.first) );
+   }
+}
+
+void elasticsearch_plugin_impl::_process_final_block( chain::block_state_ptr bs ) {
+   const auto block_num = bs->block_num;
+
+   // traces are replayed in chain order, so setabi and account upserts see the same sequence as
+   // without buffering; traces of blocks at or below block_num on other branches were orphaned
+   std::vector<budgeted<chain::transaction_trace_ptr>> traces;
+   auto itr = reversible_traces.begin();
+   while( itr != reversible_traces.end() && itr->first <= block_num ) {
+      if( itr->first == block_num ) {
+         auto found = itr->second.find( bs->id );
+         if( found != itr->second.end() ) traces = std::move( found->second );
+      }
+      itr = reversible_traces.erase( itr );
+   }
+   for( auto& t : traces ) {
+      _process_applied_transaction( std::move(t.first) );
+   }
+   traces.clear();
+
+   write_final_table_deltas( bs );
+
+   struct final_transaction {
+      transaction_id_type id;
+      chain::transaction_metadata_ptr meta; ///< empty if the transaction was not accepted by this node
+   };
+   std::vector<final_transaction> trxs;
+
+   if( store_transactions ) {
+      trxs.reserve( bs->block->transactions.size() );
+      for( const auto& receipt : bs->block->transactions ) {
+         if( receipt.trx.contains<packed_transaction>() ) {
+            const auto& pt = receipt.trx.get<packed_transaction>();
+            // get id via get_raw_transaction() as packed_transaction.id() mutates internal transaction state
+            const auto& raw = pt.get_raw_transaction();
+            const auto& trx = fc::raw::unpack<transaction>( raw );
+            if( !filter_include( trx ) ) continue;
+            const auto id = trx.id();
+
+            chain::transaction_metadata_ptr meta;
+            auto found = reversible_trxs.find( id );
+            if( found != reversible_trxs.end() ) {
+               meta = std::move( found->second.first );
+               reversible_trxs.erase( found );
+            }
+            trxs.push_back( final_transaction{id, std::move(meta)} );
+         } else {
+            trxs.push_back( final_transaction{receipt.trx.get<transaction_id_type>(), chain::transaction_metadata_ptr()} );
+         }
+      }
+
+      while( !reversible_trxs_order.empty() &&
+             reversible_trxs_order.front().first + reversible_trxs_max_age < block_num ) {
+         reversible_trxs.erase( reversible_trxs_order.front().second );
+         reversible_trxs_order.pop_front();
+      }
+   }
+
+   if( !start_block_reached || !(store_blocks || store_block_states || store_transactions) ) return;
+
+   size_t bytes = approx_size( bs );
+   for( const auto& trx : trxs ) {
+      if( trx.meta ) bytes += approx_size( trx.meta );
+   }
+   checkpoint_begin( block_num );
+   if( checkpoint ) checkpoint->irreversible( block_num );
+   enqueue_task( bytes,
+      [ bs{std::move(bs)}, trxs{std::move(trxs)}, this ]()
+      {
+         const auto block_num = bs->block_num;
+         const auto block_id_str = to_hex_string( bs->id );
+         auto end_guard = fc::make_scoped_exit( [&]() { checkpoint_end( block_num ); } );
+
+         auto docs = make_block_docs( bs );
+
+         if( store_block_states ) {
+            auto action = bulk_action( "index", block_states_index, block_id_str );
+            auto json = json_with_fields( docs->block_state, block_state_fields( bs )("irreversible", true) );
+
+            bulker& bulk = bulk_pool->get();
+            bulk.append_document(std::move(action), std::move(json), block_num);
+         }
+
+         if( store_blocks ) {
+            auto action = bulk_action( "index", blocks_index, block_id_str );
+            auto json = json_with_fields( docs->block, fc::mutable_variant_object()
+                                                          ("irreversible", true)
+                                                          ("validated", bs->validated) );
+
+            bulker& bulk = bulk_pool->get();
+            bulk.append_document(std::move(action), std::move(json), block_num);
+         }
+
+         for( const auto& trx : trxs ) {
+            fc::mutable_variant_object trans_doc;
+            if( trx.meta ) trans_doc = transaction_doc( trx.meta );
+            trans_doc("irreversible", true);
+            trans_doc("block_id", block_id_str);
+            trans_doc("block_num", static_cast<int32_t>(block_num));
+
+            const auto trx_id_str = to_hex_string( trx.id );
+            std::string action;
+            std::string json;
+            if( trx.meta ) {
+               action = bulk_action( "index", trans_index, trx_id_str );
+               json = to_json( trans_doc );
+            } else {
+               // nothing more is known about it, e.g. a deferred transaction; keep what is already there
+               fc::mutable_variant_object doc;
+               doc("doc", trans_doc);
+               doc("doc_as_upsert", true);
+               action = bulk_action( "update", trans_index, trx_id_str, 100 );
+               json = to_json( doc );
+            }
+
+            bulker& bulk = bulk_pool->get();
+            bulk.append_document(std::move(action), std::move(json), block_num);
+         }
+      }
+   );
+}
+
+std::vector<block_id_type> elasticsearch_plugin_impl::collect_orphaned_blocks( const chain::block_state_ptr& bs ) {
+   std::vector<block_id_type> orphans;
+   auto end = reversible_block_ids.upper_bound( bs->block_num );
+   for( auto it = reversible_block_ids.begin(); it != end; ++it ) {
+      for( const auto& id : it->second ) {
+         if( id != bs->id ) orphans.push_back( id );
+      }
+   }
+   reversible_block_ids.erase( reversible_block_ids.begin(), end );
+   return orphans;
+}
+
+void elasticsearch_plugin_impl::cleanup_orphaned_blocks( const std::vector<block_id_type>& ids ) {
+   std::lock_guard<std::mutex> guard(fork_mtx);
+
+   fc::variants id_strs;
+   for( const auto& id : ids ) {
+      id_strs.emplace_back( id.str() );
+   }
+   ilog( "cleanup orphaned blocks: ${ids}", ("ids", id_strs) );
+
+   // orphaned documents may still wait in a bulker, send them before removing or marking them;
+   // the tasks that produced them finished before this one was enqueued
+   bulk_pool->flush();
+
+   std::string body;
+   for( const auto& id : id_strs ) {
+      for( const auto& index : { std::make_pair(store_blocks, blocks_index), std::make_pair(store_block_states, block_states_index) } ) {
+         if( !index.first ) continue;
+
+         if( fork_handling == fork_handling_type::remove ) {
+            body.append( bulk_action( "delete", index.second, id.get_string() ) );
+            body.push_back('\n');
+         } else {
+            body.append( bulk_action( "update", index.second, id.get_string(), 100 ) );
+            body.push_back('\n');
+            body.append( fc::json::to_string( fc::variant_object("doc", fc::variant_object("orphaned", true)) ) );
+            body.push_back('\n');
+         }
+      }
+   }
+
+   fc::mutable_variant_object query_doc;
+   query_doc("query", fc::variant_object("terms", fc::variant_object("producer_block_id", id_strs)));
+   if( fork_handling == fork_handling_type::mark ) {
+      fc::mutable_variant_object script_doc;
+      script_doc("source", "ctx._source.orphaned = true;");
+      script_doc("lang", "painless");
+      query_doc("script", script_doc);
+   }
+   auto query = fc::json::to_string( query_doc );
+
+   try {
+      if( !body.empty() ) {
+         fork_es_client->bulk_perform( body );
+      }
+      for( const auto& index : { std::make_pair(store_transaction_traces, trans_traces_index),
+                                 std::make_pair(store_action_traces, action_traces_index),
+                                 std::make_pair(store_transfers, transfers_index),
+                                 std::make_pair(store_account_actions, account_actions_index) } ) {
+         if( !index.first ) continue;
+         if( fork_handling == fork_handling_type::remove ) {
+            fork_es_client->delete_by_query( index.second, query );
+         } else {
+            fork_es_client->update_by_query( index.second, query );
+         }
+      }
+   } catch( ... ) {
+      handle_elasticsearch_exception( "cleanup orphaned blocks " + query, __LINE__ );
+   }
+}
+
+memory_credit_ptr elasticsearch_plugin_impl::retain_current_credit() {
+   if( current_credit ) current_credit->retain();
+   return current_credit;
+}
+
+void elasticsearch_plugin_impl::checkpoint_begin( uint32_t block_num ) {
+   if( checkpoint && block_num ) checkpoint->begin( block_num );
+}
+
+void elasticsearch_plugin_impl::checkpoint_end( uint32_t block_num ) {
+   if( checkpoint && block_num ) checkpoint->end( block_num );
+}
+
+void elasticsearch_plugin_impl::checkpoint_fail( uint32_t block_num ) {
+   if( checkpoint && block_num ) checkpoint->fail( block_counts{ {block_num, 1} } );
+}
+
+void elasticsearch_plugin_impl::write_account_upserts( std::vector<account_upserts>& batch ) {
+   elasticlient::SameIndexBulkData bulk_account_upserts(accounts_index);
+   for( auto& upserts : batch ) {
+      for( auto& action : upserts.actions ) {
+
+         fc::mutable_variant_object source_doc;
+         fc::mutable_variant_object script_doc;
+
+         script_doc("lang", "painless");
+         script_doc("source", action.second.first);
+         script_doc("params", action.second.second);
+
+         source_doc("scripted_upsert", true);
+         source_doc("upsert", fc::variant_object());
+         source_doc("script", script_doc);
+
+         auto id = std::to_string(action.first);
+         auto json = to_json( source_doc );
+
+         bulk_account_upserts.updateDocument("_doc", id, json);
+      }
+   }
+
+   try {
+      es_client->bulk_perform(bulk_account_upserts);
+   } catch( ... ) {
+      handle_elasticsearch_exception( "upsert accounts " + bulk_account_upserts.body(), __LINE__ );
+      if( checkpoint ) {
+         // ends the blocks of the batch, and holds the checkpoint behind them
+         block_counts blocks;
+         for( const auto& upserts : batch ) {
+            if( upserts.block_num ) ++blocks[upserts.block_num];
+         }
+         checkpoint->fail( blocks );
+      }
+      return;
+   }
+   for( auto& upserts : batch ) {
+      checkpoint_end( upserts.block_num );
    }
 }
 
@@ -967,10 +1346,14 @@ void elasticsearch_plugin_impl::consume_blocks() {
          while ( transaction_metadata_queue.empty() &&
                  transaction_trace_queue.empty() &&
                  block_state_queue.empty() &&
+                 table_deltas_queue.empty() &&
                  irreversible_block_state_queue.empty() &&
+                 !flush_requested &&
                  !done ) {
             condition.wait(lock);
          }
+         const bool flush = flush_requested;
+         flush_requested = false;
 
          // capture for processing
          size_t transaction_metadata_size = transaction_metadata_queue.size();
@@ -988,6 +1371,11 @@ void elasticsearch_plugin_impl::consume_blocks() {
             block_state_process_queue = move(block_state_queue);
             block_state_queue.clear();
          }
+         size_t table_deltas_size = table_deltas_queue.size();
+         if (table_deltas_size > 0) {
+            table_deltas_process_queue = move(table_deltas_queue);
+            table_deltas_queue.clear();
+         }
          size_t irreversible_block_size = irreversible_block_state_queue.size();
          if (irreversible_block_size > 0) {
             irreversible_block_state_process_queue = move(irreversible_block_state_queue);
@@ -996,16 +1384,23 @@ void elasticsearch_plugin_impl::consume_blocks() {
 
          lock.unlock();
 
+         if( flush ) {
+            // sent by a worker, the consume thread keeps processing meanwhile
+            worker_pool->enqueue( 0, [this]() { bulk_pool->flush(); } );
+         }
+
          if (done) {
-            ilog("draining queue, size: ${q}", ("q", transaction_metadata_size + transaction_trace_size + block_state_size + irreversible_block_size));
+            ilog("draining queue, size: ${q}", ("q", transaction_metadata_size + transaction_trace_size + block_state_size + table_deltas_size + irreversible_block_size));
          }
 
          // process transactions
          auto start_time = fc::time_point::now();
          auto size = transaction_trace_process_queue.size();
          while (!transaction_trace_process_queue.empty()) {
-            const auto& t = transaction_trace_process_queue.front();
-            process_applied_transaction(t);
+            auto& e = transaction_trace_process_queue.front();
+            current_credit = std::move( e.second );
+            process_applied_transaction( e.first );
+            current_credit.reset();
             transaction_trace_process_queue.pop_front();
          }
          auto time = fc::time_point::now() - start_time;
@@ -1016,8 +1411,10 @@ void elasticsearch_plugin_impl::consume_blocks() {
          start_time = fc::time_point::now();
          size = transaction_metadata_process_queue.size();
          while (!transaction_metadata_process_queue.empty()) {
-            const auto& t = transaction_metadata_process_queue.front();
-            process_accepted_transaction(t);
+            auto& e = transaction_metadata_process_queue.front();
+            current_credit = std::move( e.second );
+            process_accepted_transaction( e.first );
+            current_credit.reset();
             transaction_metadata_process_queue.pop_front();
          }
          time = fc::time_point::now() - start_time;
@@ -1029,8 +1426,10 @@ void elasticsearch_plugin_impl::consume_blocks() {
          start_time = fc::time_point::now();
          size = block_state_process_queue.size();
          while (!block_state_process_queue.empty()) {
-            const auto& bs = block_state_process_queue.front();
-            process_accepted_block( bs );
+            auto& e = block_state_process_queue.front();
+            current_credit = std::move( e.second );
+            process_accepted_block( e.first );
+            current_credit.reset();
             block_state_process_queue.pop_front();
          }
          time = fc::time_point::now() - start_time;
@@ -1038,12 +1437,29 @@ void elasticsearch_plugin_impl::consume_blocks() {
          if( time > fc::seconds(5) ) // reduce logging, 5 secs
             ilog( "process_accepted_block,       time per: ${p}, size: ${s}, time: ${t}", ("s", size)("t", time)("p", per) );
 
+         // process table deltas
+         start_time = fc::time_point::now();
+         size = table_deltas_process_queue.size();
+         while (!table_deltas_process_queue.empty()) {
+            auto& e = table_deltas_process_queue.front();
+            current_credit = std::move( e.second );
+            process_table_deltas( e.first );
+            current_credit.reset();
+            table_deltas_process_queue.pop_front();
+         }
+         time = fc::time_point::now() - start_time;
+         per = size > 0 ? time.count()/size : 0;
+         if( time > fc::seconds(5) ) // reduce logging, 5 secs
+            ilog( "process_table_deltas,         time per: ${p}, size: ${s}, time: ${t}", ("s", size)("t", time)("p", per) );
+
          // process irreversible blocks
          start_time = fc::time_point::now();
          size = irreversible_block_state_process_queue.size();
          while (!irreversible_block_state_process_queue.empty()) {
-            const auto& bs = irreversible_block_state_process_queue.front();
-            process_irreversible_block(bs);
+            auto& e = irreversible_block_state_process_queue.front();
+            current_credit = std::move( e.second );
+            process_irreversible_block( e.first );
+            current_credit.reset();
             irreversible_block_state_process_queue.pop_front();
          }
          time = fc::time_point::now() - start_time;
@@ -1054,6 +1470,7 @@ void elasticsearch_plugin_impl::consume_blocks() {
          if( transaction_metadata_size == 0 &&
              transaction_trace_size == 0 &&
              block_state_size == 0 &&
+             table_deltas_size == 0 &&
              irreversible_block_size == 0 &&
              done ) {
             break;
@@ -1069,6 +1486,25 @@ void elasticsearch_plugin_impl::consume_blocks() {
    }
 }
 
+void elasticsearch_plugin_impl::seed_abis() {
+   ilog("copying the abis of the chain state into the abi database");
+   size_t seeded = 0;
+   const auto& idx = chain_db->get_index<chain::account_index, chain::by_name>();
+   for( const auto& account : idx ) {
+      if( account.abi.size() == 0 ) continue;
+      try {
+         abi_def abi;
+         if( abi_serializer::to_abi( account.abi, abi ) ) {
+            serializer->upsert_abi_cache( account.name, abi );
+            ++seeded;
+         }
+      } catch( fc::exception& e ) {
+         wlog("unable to seed abi of ${a}: ${e}", ("a", account.name)("e", e.to_string()));
+      }
+   }
+   ilog("copied ${n} abis of the chain state", ("n", seeded));
+}
+
 void elasticsearch_plugin_impl::init() {
    ilog("create elasticsearch index");
    es_client->init_index( accounts_index, "");
@@ -1076,7 +1512,21 @@ void elasticsearch_plugin_impl::init() {
    es_client->init_index( trans_index, "" );
    es_client->init_index( block_states_index, "" );
    es_client->init_index( trans_traces_index, "" );
-   es_client->init_index( action_traces_index, "" );
+   if ( store_transfers ) {
+      es_client->init_index( transfers_index, "" );
+   }
+   if ( store_account_actions ) {
+      es_client->init_index( account_actions_index, "" );
+   }
+   if ( !table_contracts.empty() ) {
+      es_client->init_index( table_rows_index, "" );
+      es_client->init_index( table_deltas_index, "" );
+   }
+   if ( !action_traces_router->partitioned() ) {
+      es_client->init_index( action_traces_index, "" );
+   } else {
+      action_traces_router->check_alias();
+   }
 
    if (es_client->count_doc(accounts_index) == 0) {
       fc::mutable_variant_object account_doc;
@@ -1084,7 +1534,7 @@ void elasticsearch_plugin_impl::init() {
       account_doc("name", name( acc_name ).to_string());
       account_doc("pub_keys", fc::variants());
       account_doc("account_controls", fc::variants());
-      auto json = fc::json::to_string(account_doc);
+      auto json = to_json( account_doc );
       try {
          es_client->create(accounts_index, json, std::to_string(acc_name));
       } catch( ... ) {
@@ -1104,13 +1554,47 @@ elasticsearch_plugin::~elasticsearch_plugin(){}
 void elasticsearch_plugin::set_program_options(options_description&, options_description& cfg) {
    cfg.add_options()
          ("elastic-queue-size,q", bpo::value<uint32_t>()->default_value(1024),
-         "The target queue size between nodeos and elasticsearch plugin thread.")
+         "Deprecated and ignored, the queues are bounded by --elastic-memory-budget-mb.")
+         ("elastic-memory-budget-mb", bpo::value<size_t>()->default_value(512),
+          "The memory(megabytes) held by queued blocks and traces, pending tasks and bulk bodies before nodeos is made to wait.")
          ("elastic-thread-pool-size", bpo::value<size_t>()->default_value(4),
           "The size of the data processing thread pool.")
+         ("elastic-thread-pool-queue-mb", bpo::value<size_t>()->default_value(256),
+          "The memory(megabytes) retained by the tasks queued in the thread pool before more wait.")
+         ("elastic-worker-cpus", bpo::value<std::string>()->default_value(""),
+          "Pin the thread pool workers to these cpus, e.g. 4-7 or 4,6, and move the other nodeos threads off them. Not pinned if empty.")
+         ("elastic-account-queue-size", bpo::value<size_t>()->default_value(1024),
+          "The transactions whose account updates may wait for the accounts writer before more wait.")
          ("elastic-bulk-size-mb", bpo::value<size_t>()->default_value(5),
           "The size(megabytes) of the each bulk request.")
+         ("elastic-bulk-adaptive", bpo::value<bool>()->default_value(false),
+          "Adjust the bulk size and the number of concurrent bulk requests to the observed elasticsearch latency and rejections.")
+         ("elastic-bulk-size-min-mb", bpo::value<size_t>()->default_value(1),
+          "The smallest bulk size(megabytes) chosen by --elastic-bulk-adaptive.")
+         ("elastic-bulk-size-max-mb", bpo::value<size_t>()->default_value(20),
+          "The largest bulk size(megabytes) chosen by --elastic-bulk-adaptive.")
+         ("elastic-bulk-target-latency-ms", bpo::value<uint32_t>()->default_value(1000),
+          "The bulk round trip time --elastic-bulk-adaptive keeps requests under.")
          ("elastic-abi-db-size-mb", bpo::value<size_t>()->default_value(1024),
           "Maximum size(megabytes) of the abi database.")
+         ("elastic-abi-cache-size", bpo::value<size_t>()->default_value(1024),
+          "The number of decoded abis kept in memory.")
+         ("elastic-abi-warm-up", bpo::value<size_t>()->default_value(128),
+          "The number of most used abis of the previous runs decoded at startup. 0 to decode on first use only.")
+         ("elastic-abi-seed-from-state", bpo::value<bool>()->default_value(false),
+          "Copy the abis of all accounts in the chain state into the abi database at startup, e.g. when starting from a snapshot.")
+         ("elastic-api", bpo::value<bool>()->default_value(false),
+          "Serve get_actions, get_transaction and get_account from elasticsearch at /v1/elasticsearch/, requires the http_plugin.")
+         ("elastic-api-threads", bpo::value<size_t>()->default_value(2),
+          "The number of threads querying elasticsearch for the api.")
+         ("elastic-api-cache-size", bpo::value<size_t>()->default_value(10000),
+          "The number of api results of settled irreversible blocks kept in memory, requires --elastic-checkpoint.")
+         ("elastic-api-refresh-ms", bpo::value<int64_t>()->default_value(1000),
+          "The index.refresh_interval of the indices in milliseconds. Api results are cached once this much after their blocks were acknowledged, -1 to cache nothing.")
+         ("elastic-abi-slow-decode-ms", bpo::value<uint32_t>()->default_value(100),
+          "Decoding the data of an action or table row that takes longer counts against the abi of its contract.")
+         ("elastic-abi-max-slow-decodes", bpo::value<uint32_t>()->default_value(10),
+          "Slow or failed decodes after which the data of a contract is stored as hex until it sets a new abi. 0 to never.")
          ("elastic-block-start", bpo::value<uint32_t>()->default_value(0),
          "If specified then only abi data pushed to elasticsearch until specified block is reached.")
          ("elastic-url,u", bpo::value<std::string>(),
@@ -1129,6 +1613,18 @@ void elasticsearch_plugin::set_program_options(options_description&, options_des
           "Enables storing transaction traces in elasticsearch.")
          ("elastic-store-action-traces", bpo::value<bool>()->default_value(true),
           "Enables storing action traces in elasticsearch.")
+         ("elastic-action-traces-enrich", bpo::value<bool>()->default_value(false),
+          "Add the position in the transaction (action_ordinal, creator_action_ordinal, creator_global_sequence, creator_action) and scheduled to action traces.")
+         ("elastic-action-traces-routing", bpo::value<bool>()->default_value(false),
+          "Route action traces to shards by receiver, so the history of an account is read from a single shard.")
+         ("elastic-store-account-actions", bpo::value<bool>()->default_value(false),
+          "Enables storing a compact (account, global_sequence, block_num, action) row per action trace, routed by account.")
+         ("elastic-table-contracts", bpo::value<vector<string>>()->composing(),
+          "Contract whose table rows are stored in the table_rows (current state) and table_deltas (history) indices. May be specified multiple times.")
+         ("elastic-store-transfers", bpo::value<bool>()->default_value(false),
+          "Enables storing transfers of the --elastic-transfer-contracts with typed from, to, quantity and symbol fields.")
+         ("elastic-transfer-contracts", bpo::value<vector<string>>()->composing()->default_value(vector<string>{"eosio.token"}, "eosio.token"),
+          "Token contract whose transfer actions are stored in the transfers index. May be specified multiple times.")
          ("elastic-filter-on", bpo::value<vector<string>>()->composing(),
           "Track actions which match receiver:action:actor. Receiver, Action, & Actor may be blank to include all. i.e. eosio:: or :transfer:  Use * or leave unspecified to include all.")
          ("elastic-filter-out", bpo::value<vector<string>>()->composing(),
@@ -1145,6 +1641,38 @@ void elasticsearch_plugin::set_program_options(options_description&, options_des
           "elasticsearch transaction_traces index name.")
          ("elastic-index-action-traces", bpo::value<std::string>()->default_value("action_traces"),
           "elasticsearch action_traces index name.")
+         ("elastic-index-transfers", bpo::value<std::string>()->default_value("transfers"),
+          "elasticsearch transfers index name.")
+         ("elastic-index-account-actions", bpo::value<std::string>()->default_value("account_actions"),
+          "elasticsearch account_actions index name.")
+         ("elastic-index-table-rows", bpo::value<std::string>()->default_value("table_rows"),
+          "elasticsearch table_rows index name.")
+         ("elastic-index-table-deltas", bpo::value<std::string>()->default_value("table_deltas"),
+          "elasticsearch table_deltas index name.")
+         ("elastic-checkpoint", bpo::value<bool>()->default_value(false),
+          "Persist the highest fully indexed block and resume from it on restart.")
+         ("elastic-checkpoint-interval", bpo::value<uint32_t>()->default_value(1000),
+          "The number of blocks between checkpoint writes.")
+         ("elastic-index-checkpoint", bpo::value<std::string>()->default_value("checkpoint"),
+          "elasticsearch checkpoint index name.")
+         ("elastic-fork-handling", bpo::value<std::string>()->default_value("none"),
+          "What to do with documents of blocks orphaned by a fork once a competing block becomes irreversible. none, delete or mark (set orphaned: true).")
+         ("elastic-blocks-fields", bpo::value<std::string>()->default_value(""),
+          "Comma separated fields of blocks documents to store, e.g. block_num,producer,timestamp. Nested fields are given as header.producer. Empty to store all.")
+         ("elastic-block-states-fields", bpo::value<std::string>()->default_value(""),
+          "Comma separated fields of block_states documents to store. Empty to store all.")
+         ("elastic-transactions-fields", bpo::value<std::string>()->default_value(""),
+          "Comma separated fields of transactions documents to store. trx_id, signing_keys and the block fields are always stored. Empty to store all.")
+         ("elastic-transaction-traces-fields", bpo::value<std::string>()->default_value(""),
+          "Comma separated fields of transaction_traces documents to store. Empty to store all.")
+         ("elastic-action-traces-fields", bpo::value<std::string>()->default_value(""),
+          "Comma separated fields of action_traces documents to store. Empty to store all.")
+         ("elastic-irreversible-only", bpo::value<bool>()->default_value(false),
+          "Buffer reversible data in memory and write each document once, fully formed, when its block becomes irreversible.")
+         ("elastic-action-traces-partition", bpo::value<std::string>()->default_value("none"),
+          "Partition action_traces into indices behind the action_traces alias. none, block (by block number range) or month (by block_time).")
+         ("elastic-action-traces-partition-blocks", bpo::value<uint32_t>()->default_value(10000000),
+          "The number of blocks per action_traces index when partitioning by block.")
          ;
 }
 
@@ -1160,11 +1688,14 @@ void elasticsearch_plugin::plugin_initialize(const variables_map& options) {
                        chain::plugin_config_exception, "--abi-serializer-max-time-ms required as default value not appropriate for parsing full blocks");
             fc::microseconds abi_serializer_max_time = app().get_plugin<chain_plugin>().get_abi_serializer_max_time();
             auto db_size = options.at( "elastic-abi-db-size-mb" ).as<size_t>();
-            my->serializer.reset(new serializer(app().data_dir() / "abi", abi_serializer_max_time, db_size*1024*1024ll));
+            auto cache_size = options.at( "elastic-abi-cache-size" ).as<size_t>();
+            my->serializer.reset(new serializer(app().data_dir() / "abi", abi_serializer_max_time, db_size*1024*1024ll, cache_size));
+            my->serializer->set_circuit_breaker( fc::milliseconds( options.at( "elastic-abi-slow-decode-ms" ).as<uint32_t>() ),
+                                                 options.at( "elastic-abi-max-slow-decodes" ).as<uint32_t>() );
          }
 
-         if( options.count( "elastic-queue-size" )) {
-            my->max_queue_size = options.at( "elastic-queue-size" ).as<uint32_t>();
+         if( !options.at( "elastic-queue-size" ).defaulted() ) {
+            wlog( "--elastic-queue-size is ignored, use --elastic-memory-budget-mb" );
          }
          if( options.count( "elastic-block-start" )) {
             my->start_block_num = options.at( "elastic-block-start" ).as<uint32_t>();
@@ -1184,36 +1715,23 @@ void elasticsearch_plugin::plugin_initialize(const variables_map& options) {
          if( options.count( "elastic-store-action-traces" )) {
             my->store_action_traces = options.at( "elastic-store-action-traces" ).as<bool>();
          }
-        if( options.count( "elastic-filter-on" )) {
-            auto fo = options.at( "elastic-filter-on" ).as<vector<string>>();
-            my->filter_on_star = false;
-            for( auto& s : fo ) {
-               if( s == "*" ) {
-                  my->filter_on_star = true;
-                  break;
-               }
-               std::vector<std::string> v;
-               boost::split( v, s, boost::is_any_of( ":" ));
-               EOS_ASSERT( v.size() == 3, fc::invalid_arg_exception, "Invalid value ${s} for --elastic-filter-on", ("s", s));
-               filter_entry fe{v[0], v[1], v[2]};
-               my->filter_on.insert( fe );
+         my->enrich_action_traces = options.at( "elastic-action-traces-enrich" ).as<bool>();
+         my->route_action_traces = options.at( "elastic-action-traces-routing" ).as<bool>();
+         my->store_account_actions = options.at( "elastic-store-account-actions" ).as<bool>();
+         if( options.count( "elastic-table-contracts" )) {
+            for( const auto& c : options.at( "elastic-table-contracts" ).as<vector<string>>() ) {
+               my->table_contracts.insert( account_name( c ) );
             }
-         } else {
-            my->filter_on_star = true;
          }
-         if( options.count( "elastic-filter-out" )) {
-            auto fo = options.at( "elastic-filter-out" ).as<vector<string>>();
-            for( auto& s : fo ) {
-               std::vector<std::string> v;
-               boost::split( v, s, boost::is_any_of( ":" ));
-               EOS_ASSERT( v.size() == 3, fc::invalid_arg_exception, "Invalid value ${s} for --elastic-filter-out", ("s", s));
-               filter_entry fe{v[0], v[1], v[2]};
-               my->filter_out.insert( fe );
-            }
+         my->store_transfers = options.at( "elastic-store-transfers" ).as<bool>();
+         for( const auto& c : options.at( "elastic-transfer-contracts" ).as<vector<string>>() ) {
+            my->transfer_contracts.insert( account_name( c ) );
          }
-
-         if( my->start_block_num == 0 ) {
-            my->start_block_reached = true;
+         if( options.count( "elastic-filter-on" )) {
+            my->filter.add_on( options.at( "elastic-filter-on" ).as<vector<string>>() );
+         }
+         if( options.count( "elastic-filter-out" )) {
+            my->filter.add_out( options.at( "elastic-filter-out" ).as<vector<string>>() );
          }
 
          my->accounts_index = options.at("elastic-index-accounts").as<std::string>();
@@ -1222,6 +1740,17 @@ void elasticsearch_plugin::plugin_initialize(const variables_map& options) {
          my->block_states_index = options.at("elastic-index-block-states").as<std::string>();
          my->trans_traces_index = options.at("elastic-index-transaction-traces").as<std::string>();
          my->action_traces_index = options.at("elastic-index-action-traces").as<std::string>();
+         my->transfers_index = options.at("elastic-index-transfers").as<std::string>();
+         my->account_actions_index = options.at("elastic-index-account-actions").as<std::string>();
+         my->table_rows_index = options.at("elastic-index-table-rows").as<std::string>();
+         my->table_deltas_index = options.at("elastic-index-table-deltas").as<std::string>();
+
+         my->blocks_fields = field_projection::parse( options.at( "elastic-blocks-fields" ).as<std::string>() );
+         my->block_states_fields = field_projection::parse( options.at( "elastic-block-states-fields" ).as<std::string>() );
+         my->block_states_fields.exclude( "block" );
+         my->trans_fields = field_projection::parse( options.at( "elastic-transactions-fields" ).as<std::string>() );
+         my->trans_traces_fields = field_projection::parse( options.at( "elastic-transaction-traces-fields" ).as<std::string>() );
+         my->action_traces_fields = field_projection::parse( options.at( "elastic-action-traces-fields" ).as<std::string>() );
 
          std::string url_str = options.at( "elastic-url" ).as<std::string>();
          if ( url_str.back() != '/' ) url_str.push_back('/');
@@ -1230,22 +1759,140 @@ void elasticsearch_plugin::plugin_initialize(const variables_map& options) {
          size_t thr_pool_size = options.at( "elastic-thread-pool-size" ).as<size_t>();
          size_t bulk_size = options.at( "elastic-bulk-size-mb" ).as<size_t>();
 
+         chain_plugin* chain_plug = app().find_plugin<chain_plugin>();
+         EOS_ASSERT( chain_plug, chain::missing_chain_plugin_exception, "" );
+         auto& chain = chain_plug->chain();
+         my->chain_id.emplace( chain.get_chain_id());
+         my->chain_db = &chain.db();
+
          my->es_client.reset( new elastic_client(std::vector<std::string>({url_str}), user_str, password_str) );
 
-         ilog("init thread pool, size: ${tps}", ("tps", thr_pool_size));
-         my->thread_pool.reset( new ThreadPool(thr_pool_size) );
-         my->max_task_queue_size = my->max_queue_size * 8;
+         auto fork_handling = options.at( "elastic-fork-handling" ).as<std::string>();
+         if( fork_handling == "delete" ) {
+            my->fork_handling = elasticsearch_plugin_impl::fork_handling_type::remove;
+         } else if( fork_handling == "mark" ) {
+            my->fork_handling = elasticsearch_plugin_impl::fork_handling_type::mark;
+         } else {
+            EOS_ASSERT( fork_handling == "none", chain::plugin_config_exception, "unknown --elastic-fork-handling: ${s}", ("s", fork_handling) );
+         }
+         if( my->fork_handling != elasticsearch_plugin_impl::fork_handling_type::none ) {
+            my->fork_es_client.reset( new elastic_client(std::vector<std::string>({url_str}), user_str, password_str) );
+         }
+
+         my->irreversible_only = options.at( "elastic-irreversible-only" ).as<bool>();
+         if( my->irreversible_only && my->fork_handling != elasticsearch_plugin_impl::fork_handling_type::none ) {
+            wlog( "--elastic-fork-handling ignored, nothing of orphaned blocks is written with --elastic-irreversible-only" );
+            my->fork_handling = elasticsearch_plugin_impl::fork_handling_type::none;
+            my->fork_es_client.reset();
+         }
+
+         if( options.at( "elastic-checkpoint" ).as<bool>() ) {
+            auto interval = options.at( "elastic-checkpoint-interval" ).as<uint32_t>();
+            auto index_name = options.at( "elastic-index-checkpoint" ).as<std::string>();
+            my->checkpoint.reset( new checkpoint_tracker(app().data_dir() / "elasticsearch_checkpoint.json",
+                                  index_name, my->chain_id->str(), interval,
+                                  std::vector<std::string>({url_str}), user_str, password_str) );
+            // resume at the checkpoint block itself: traces of a block are applied before the block is
+            // accepted, so documents are generated again from the traces of the block after it.
+            auto resume_block_num = my->checkpoint->load();
+            if( resume_block_num > my->start_block_num ) {
+               ilog( "resuming from elasticsearch checkpoint, block_num: ${n}", ("n", resume_block_num) );
+               my->start_block_num = resume_block_num;
+            }
+         }
+
+         if( my->start_block_num == 0 ) {
+            my->start_block_reached = true;
+         }
+
+         auto partition_type = index_router::parse_partition_type(
+            options.at( "elastic-action-traces-partition" ).as<std::string>() );
+         auto partition_blocks = options.at( "elastic-action-traces-partition-blocks" ).as<uint32_t>();
+         EOS_ASSERT( partition_blocks > 0, chain::plugin_config_exception, "--elastic-action-traces-partition-blocks must be greater than 0" );
+         my->action_traces_router.reset( new index_router(my->action_traces_index, partition_type, partition_blocks,
+                                         std::vector<std::string>({url_str}), user_str, password_str) );
+
+         auto pool_queue_size = options.at( "elastic-thread-pool-queue-mb" ).as<size_t>();
+         auto worker_cpus = thread_pool::parse_cpu_list( options.at( "elastic-worker-cpus" ).as<std::string>() );
+         ilog("init thread pool, size: ${tps}, queue: ${q}mb, cpus: ${c}", ("tps", thr_pool_size)("q", pool_queue_size)("c", worker_cpus));
+         // before the workers start, the threads of plugins started later inherit the affinity of the main thread
+         thread_pool::keep_threads_off( worker_cpus );
+         my->worker_pool.reset( new thread_pool(thr_pool_size, pool_queue_size * 1024 * 1024, worker_cpus) );
+
+         my->abi_warm_up = options.at( "elastic-abi-warm-up" ).as<size_t>();
+         my->abi_warm_up_threads = thr_pool_size;
+         my->seed_abis_from_state = options.at( "elastic-abi-seed-from-state" ).as<bool>();
+         if( my->serializer && !my->seed_abis_from_state ) {
+            // before the chain_plugin replays any block; with seeding it waits for plugin_startup
+            my->serializer->warm_up( my->abi_warm_up, my->abi_warm_up_threads );
+         }
+
+         if( options.at( "elastic-api" ).as<bool>() ) {
+            query_api::index_names indices{ my->accounts_index, my->trans_index, my->trans_traces_index, my->action_traces_index };
+            auto api_threads = options.at( "elastic-api-threads" ).as<size_t>();
+            auto api_cache_size = options.at( "elastic-api-cache-size" ).as<size_t>();
+            auto api_refresh_ms = options.at( "elastic-api-refresh-ms" ).as<int64_t>();
+            EOS_ASSERT( api_threads > 0, chain::plugin_config_exception, "--elastic-api-threads must be greater than 0" );
+            EOS_ASSERT( api_refresh_ms >= -1, chain::plugin_config_exception, "--elastic-api-refresh-ms must be -1 or greater" );
+            if( api_cache_size > 0 && !options.at( "elastic-checkpoint" ).as<bool>() ) {
+               wlog( "--elastic-api-cache-size needs --elastic-checkpoint=true to know which results are final, nothing is cached" );
+            }
+            if( api_refresh_ms < 0 ) {
+               // documents are visible to search at unknown times, nothing is known to be settled
+               api_cache_size = 0;
+            }
+            // a refresh takes a while itself, the margin covers it
+            auto refresh_delay = std::chrono::milliseconds( api_refresh_ms + 500 );
+            ilog("init query api, threads: ${t}, cache size: ${c}", ("t", api_threads)("c", api_cache_size));
+            my->query = std::make_shared<query_api>( api_threads, api_cache_size, refresh_delay, my->route_action_traces, indices,
+                                                     std::vector<std::string>({url_str}), user_str, password_str );
+         }
+
+         auto account_queue_size = options.at( "elastic-account-queue-size" ).as<size_t>();
+         EOS_ASSERT( account_queue_size > 0, chain::plugin_config_exception, "--elastic-account-queue-size must be greater than 0" );
+         my->account_lane.reset( new account_upsert_lane(account_queue_size,
+            [impl = my.get()]( std::vector<account_upserts>& batch ) { impl->write_account_upserts( batch ); }) );
 
          ilog("bulk request size: ${bs}mb", ("bs", bulk_size));
+         std::unique_ptr<bulk_controller> bulk_ctl;
+         size_t largest_bulk_size = bulk_size;
+         if( options.at( "elastic-bulk-adaptive" ).as<bool>() ) {
+            auto min_size = options.at( "elastic-bulk-size-min-mb" ).as<size_t>();
+            auto max_size = options.at( "elastic-bulk-size-max-mb" ).as<size_t>();
+            largest_bulk_size = max_size;
+            auto target_latency = options.at( "elastic-bulk-target-latency-ms" ).as<uint32_t>();
+            EOS_ASSERT( min_size > 0 && min_size <= max_size, chain::plugin_config_exception,
+                        "--elastic-bulk-size-min-mb must be greater than 0 and not greater than --elastic-bulk-size-max-mb" );
+            ilog("adaptive bulk size: ${min}mb - ${max}mb, target latency: ${t}ms", ("min", min_size)("max", max_size)("t", target_latency));
+            bulk_ctl.reset( new bulk_controller(bulk_size * 1024 * 1024, min_size * 1024 * 1024, max_size * 1024 * 1024,
+                                                thr_pool_size, fc::milliseconds(target_latency)) );
+         }
+
+         auto budget_size = options.at( "elastic-memory-budget-mb" ).as<size_t>();
+         // every bulker may hold a partly filled body, the rest of the budget has to let blocks through to fill them
+         const auto min_budget_size = 2 * thr_pool_size * largest_bulk_size;
+         if( budget_size < min_budget_size ) {
+            wlog( "--elastic-memory-budget-mb ${b} is less than twice the bulk bodies of the thread pool, using ${m}",
+                  ("b", budget_size)("m", min_budget_size) );
+            budget_size = min_budget_size;
+         }
+         ilog("memory budget: ${m}mb", ("m", budget_size));
+         my->budget.reset( new memory_budget(budget_size * 1024 * 1024) );
+
          my->bulk_pool.reset( new bulker_pool(thr_pool_size, bulk_size * 1024 * 1024,
-                              std::vector<std::string>({url_str}), user_str, password_str) );
+                              std::vector<std::string>({url_str}), user_str, password_str,
+                              my->checkpoint.get(), std::move(bulk_ctl), my->budget.get()) );
+         // with little traffic partly filled bodies would hold their credits until more blocks arrive,
+         // the waiting chain thread only asks for the flush, sending them is up to a worker
+         my->budget->set_stall_handler( [impl = my.get()]() {
+            {
+               std::lock_guard<std::mutex> guard( impl->mtx );
+               impl->flush_requested = true;
+            }
+            impl->condition.notify_one();
+         } );
 
          // hook up to signals on controller
-         chain_plugin* chain_plug = app().find_plugin<chain_plugin>();
-         EOS_ASSERT( chain_plug, chain::missing_chain_plugin_exception, "" );
-         auto& chain = chain_plug->chain();
-         my->chain_id.emplace( chain.get_chain_id());
-
          my->accepted_block_connection.emplace(
             chain.accepted_block.connect( [&]( const chain::block_state_ptr& bs ) {
             my->accepted_block( bs );
@@ -1273,7 +1920,25 @@ void elasticsearch_plugin::plugin_initialize(const variables_map& options) {
 }
 
 void elasticsearch_plugin::plugin_startup() {
-   // Make the magic happen
+   // the chain state, restored from a snapshot or not, is loaded by the time the chain_plugin has started
+   if( my->configured && my->seed_abis_from_state && my->serializer ) {
+      my->seed_abis();
+      // seeding replaces the abis, which evicts their decoded instances
+      my->serializer->warm_up( my->abi_warm_up, my->abi_warm_up_threads );
+   }
+
+   if( my->configured && my->query ) {
+      auto* http = app().find_plugin<http_plugin>();
+      EOS_ASSERT( http && http->get_state() != abstract_plugin::registered, chain::plugin_config_exception,
+                  "--elastic-api requires the http_plugin, add --plugin eosio::http_plugin" );
+      // the handlers keep the api alive for as long as the http_plugin holds them
+      http->add_api({
+         query_handler( my->query, "get_actions", &query_api::get_actions ),
+         query_handler( my->query, "get_transaction", &query_api::get_transaction ),
+         query_handler( my->query, "get_account", &query_api::get_account )
+      });
+      ilog("elasticsearch query api at /v1/elasticsearch/");
+   }
 }
 
 void elasticsearch_plugin::plugin_shutdown() {
@@ -1282,6 +1947,8 @@ void elasticsearch_plugin::plugin_shutdown() {
    my->accepted_transaction_connection.reset();
    my->applied_transaction_connection.reset();
 
+   // the pipeline drains into bulks on shutdown, a rejecting cluster must not hold that up forever
+   if( my->bulk_pool ) my->bulk_pool->stop_retrying();
    my.reset();
 }
 
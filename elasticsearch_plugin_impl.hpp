@@ -0,0 +1,263 @@
+#pragma once
+#include <eosio/elasticsearch_plugin/elasticsearch_plugin.hpp>
+#include <eosio/chain/eosio_contract.hpp>
+#include <eosio/chain/config.hpp>
+#include <eosio/chain/exceptions.hpp>
+#include <eosio/chain/transaction.hpp>
+#include <eosio/chain/types.hpp>
+
+#include <fc/variant_object.hpp>
+
+#include <boost/signals2/connection.hpp>
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <set>
+#include <unordered_map>
+
+#include "elastic_client.hpp"
+#include "serializer.hpp"
+#include "checkpoint.hpp"
+#include "bulker.hpp"
+#include "index_router.hpp"
+#include "projection.hpp"
+#include "documents.hpp"
+#include "table_deltas.hpp"
+#include "block_doc_cache.hpp"
+#include "memory_budget.hpp"
+#include "thread_pool.hpp"
+#include "account_upsert_lane.hpp"
+#include "query_api.hpp"
+
+
+namespace eosio {
+
+using chain::account_name;
+using chain::action_name;
+using chain::block_id_type;
+using chain::permission_name;
+using chain::transaction;
+using chain::signed_transaction;
+using chain::signed_block;
+using chain::transaction_id_type;
+using chain::packed_transaction;
+
+/// position of an action trace in the execution tree of its transaction
+struct action_trace_position {
+   uint32_t action_ordinal = 0;                      ///< 1-based, in execution order
+   uint32_t creator_action_ordinal = 0;              ///< 0 for actions of the transaction itself
+   const chain::action_trace* creator = nullptr;     ///< the action that sent this inline action
+};
+
+/// action traces of a transaction selected for indexing, shared by the tasks writing their documents
+struct selected_action_traces {
+   std::vector<std::reference_wrapper<chain::base_action_trace>> traces; ///< without inline action traces
+   std::vector<action_trace_position> positions; ///< parallel to traces if enrich_action_traces
+};
+
+class elasticsearch_plugin_impl {
+public:
+   enum class fork_handling_type { none, remove, mark };
+
+   elasticsearch_plugin_impl();
+   ~elasticsearch_plugin_impl();
+
+   fc::optional<boost::signals2::scoped_connection> accepted_block_connection;
+   fc::optional<boost::signals2::scoped_connection> irreversible_block_connection;
+   fc::optional<boost::signals2::scoped_connection> accepted_transaction_connection;
+   fc::optional<boost::signals2::scoped_connection> applied_transaction_connection;
+
+   void consume_blocks();
+
+   void accepted_block( const chain::block_state_ptr& );
+   void applied_irreversible_block(const chain::block_state_ptr&);
+   void accepted_transaction(const chain::transaction_metadata_ptr&);
+   void applied_transaction(const chain::transaction_trace_ptr&);
+
+   void process_applied_transaction(chain::transaction_trace_ptr);
+   void _process_applied_transaction(chain::transaction_trace_ptr);
+   void process_accepted_transaction(chain::transaction_metadata_ptr);
+   void _process_accepted_transaction(chain::transaction_metadata_ptr);
+   void process_accepted_block( chain::block_state_ptr );
+   void _process_accepted_block( chain::block_state_ptr );
+   void process_table_deltas( block_table_deltas_ptr );
+   void _process_table_deltas( block_table_deltas_ptr );
+   void process_irreversible_block( chain::block_state_ptr );
+   void _process_irreversible_block( chain::block_state_ptr );
+   /// irreversible-only mode: processes the buffered data of bs and writes its final documents
+   void _process_final_block( chain::block_state_ptr );
+   /// writes the buffered table deltas of bs and drops those of the blocks at or below it on other branches
+   void write_final_table_deltas( const chain::block_state_ptr& bs );
+
+   /// @return obj converted with the abis of its contracts, limited to the fields selected by p
+   template<typename T>
+   fc::variant project_with_abi( const T& obj, const field_projection& p ) {
+      return project( obj, p, [this]( const auto& v ) { return serializer->to_variant_with_abi( v ); } );
+   }
+
+   /// @return the transactions document of t without block information
+   fc::mutable_variant_object transaction_doc( const chain::transaction_metadata_ptr& t );
+
+   /// @return the JSON of the block_states document of bs without the fields of block_state_fields
+   std::string block_state_json( const chain::block_state_ptr& bs );
+   /// @return the stored fields of the block_states document of bs that change until it is irreversible
+   fc::mutable_variant_object block_state_fields( const chain::block_state_ptr& bs );
+   /// @return the JSON of the stored blocks and block_states documents of bs
+   block_docs_ptr make_block_docs( const chain::block_state_ptr& bs );
+   /// @return the scripted upsert source of the accepted block_states document
+   std::string accepted_block_state_source( const block_docs& docs, const chain::block_state_ptr& bs );
+   /// @return the scripted upsert source of the accepted blocks document
+   std::string accepted_block_source( const block_docs& docs );
+
+   void upsert_account(
+         std::unordered_map<uint64_t, std::pair<std::string, fc::mutable_variant_object>> &account_upsert_actions,
+         const chain::action& act, const chain::block_timestamp_type& block_time );
+   void create_new_account( fc::mutable_variant_object& param_doc, const chain::newaccount& newacc, const chain::block_timestamp_type& block_time );
+   void update_account_auth( fc::mutable_variant_object& param_doc, const chain::updateauth& update );
+   void delete_account_auth( fc::mutable_variant_object& param_doc, const chain::deleteauth& del );
+   void upsert_account_setabi( fc::mutable_variant_object& param_doc, const chain::setabi& setabi );
+   /// writes the upserts of the batch in one bulk request, on the account lane thread
+   void write_account_upserts( std::vector<account_upserts>& batch );
+   /// appends the action_traces documents of selected.traces[begin, end)
+   void index_action_traces( const chain::transaction_trace& t, const selected_action_traces& selected,
+                             size_t begin, size_t end );
+   /// appends the transfers document of atrace, if its data is a standard token transfer
+   void index_transfer( const chain::base_action_trace& atrace );
+
+   /// @return true if act should be added to elasticsearch, false to skip it
+   bool filter_include( const account_name& receiver, const action_name& act_name,
+                        const vector<chain::permission_level>& authorization ) const {
+      return filter.include( receiver, act_name, authorization );
+   }
+   bool filter_include( const transaction& trx ) const { return filter.include( trx ); }
+
+   /// @return ids of the tracked reversible blocks at or below bs that are not on its branch
+   std::vector<block_id_type> collect_orphaned_blocks( const chain::block_state_ptr& bs );
+   void cleanup_orphaned_blocks( const std::vector<block_id_type>& ids );
+
+   void checkpoint_begin( uint32_t block_num );
+   void checkpoint_end( uint32_t block_num );
+   /// ends a task of block_num that did not write its documents, the checkpoint stays below the block
+   void checkpoint_fail( uint32_t block_num );
+
+   /// copies the abis of the accounts in the chain state into the abi database
+   void seed_abis();
+
+   void init();
+
+   template<typename Queue, typename Entry> void queue(Queue& queue, const Entry& e);
+   /// runs task on the thread pool, holding the credit of the entry being processed
+   /// @param bytes approximate memory retained by the captures of task
+   template<typename Task> void enqueue_task(size_t bytes, Task&& task);
+
+   bool configured{false};
+   bool delete_index_on_startup{false};
+   uint32_t start_block_num = 0;
+   std::atomic_bool start_block_reached{false};
+
+   action_filter filter;
+   bool store_blocks = true;
+   bool store_block_states = true;
+   bool store_transactions = true;
+   bool store_transaction_traces = true;
+   bool store_action_traces = true;
+   bool enrich_action_traces = false;
+   bool route_action_traces = false;
+   bool store_account_actions = false;
+   std::set<account_name> table_contracts; ///< store table deltas of these contracts, none if empty
+   const chainbase::database* chain_db = nullptr;
+   bool seed_abis_from_state = false;
+   size_t abi_warm_up = 0; ///< abis decoded at startup, after the seeding that would evict them
+   size_t abi_warm_up_threads = 1;
+   bool store_transfers = false;
+   std::set<account_name> transfer_contracts;
+
+   field_projection blocks_fields;
+   field_projection block_states_fields; ///< never includes block, which is stored in the blocks index
+   field_projection trans_fields;
+   field_projection trans_traces_fields;
+   field_projection action_traces_fields;
+
+   fork_handling_type fork_handling = fork_handling_type::none;
+   std::map<uint32_t, std::vector<block_id_type>> reversible_block_ids; ///< accessed by consume thread only
+   std::unique_ptr<elastic_client> fork_es_client;
+   block_doc_cache block_docs_cache;
+   std::mutex fork_mtx;
+
+   uint32_t pending_block_num = 0; ///< the block accepted transactions are attributed to for checkpointing
+
+   /// declared before everything holding its credits, so it is destroyed after them
+   std::unique_ptr<memory_budget> budget; ///< no limit if not set
+   /// an entry with the budget credit it holds
+   template<typename Entry> using budgeted = std::pair<Entry, memory_credit_ptr>;
+
+   bool irreversible_only = false;
+   /// traces of reversible blocks by block_num and producer_block_id, accessed by consume thread only
+   std::map<uint32_t, std::map<block_id_type, std::vector<budgeted<chain::transaction_trace_ptr>>>> reversible_traces;
+   /// accepted transactions not yet seen in an irreversible block, accessed by consume thread only
+   std::map<transaction_id_type, budgeted<chain::transaction_metadata_ptr>> reversible_trxs;
+   std::deque<std::pair<uint32_t, transaction_id_type>> reversible_trxs_order; ///< (pending_block_num, id)
+   /// table deltas of reversible blocks by block_num and block id, in every mode since the current rows
+   /// of table_rows cannot be rolled back; accessed by consume thread only
+   std::map<uint32_t, std::map<block_id_type, budgeted<block_table_deltas_ptr>>> reversible_table_deltas;
+   static const uint32_t reversible_trxs_max_age = 360; ///< blocks, a bit more than the reversible window
+   static const size_t action_traces_chunk_size = 256; ///< action traces decoded by one task
+
+   /// signal queue entries with the budget credit they hold until they are processed
+   template<typename Entry> using budgeted_queue = std::deque<budgeted<Entry>>;
+
+   memory_credit_ptr current_credit; ///< credit of the entry being processed, accessed by consume thread only
+   /// @return current_credit, retained by the reversible buffers until the block is final
+   memory_credit_ptr retain_current_credit();
+   budgeted_queue<chain::transaction_metadata_ptr> transaction_metadata_queue;
+   budgeted_queue<chain::transaction_metadata_ptr> transaction_metadata_process_queue;
+   budgeted_queue<chain::transaction_trace_ptr> transaction_trace_queue;
+   budgeted_queue<chain::transaction_trace_ptr> transaction_trace_process_queue;
+   budgeted_queue<chain::block_state_ptr> block_state_queue;
+   budgeted_queue<chain::block_state_ptr> block_state_process_queue;
+   budgeted_queue<block_table_deltas_ptr> table_deltas_queue;
+   budgeted_queue<block_table_deltas_ptr> table_deltas_process_queue;
+   budgeted_queue<chain::block_state_ptr> irreversible_block_state_queue;
+   budgeted_queue<chain::block_state_ptr> irreversible_block_state_process_queue;
+   std::mutex mtx;
+   std::condition_variable condition;
+   std::thread consume_thread;
+   std::atomic<bool> done{false};
+   std::atomic<bool> startup{true};
+   bool flush_requested = false; ///< guarded by mtx, the consume thread hands a bulk flush to a worker
+   fc::optional<chain::chain_id_type> chain_id;
+
+   std::unique_ptr<elastic_client> es_client;
+   std::unique_ptr<serializer> serializer;
+   std::unique_ptr<checkpoint_tracker> checkpoint;
+   std::unique_ptr<bulker_pool> bulk_pool;
+   std::unique_ptr<thread_pool> worker_pool;
+   std::unique_ptr<account_upsert_lane> account_lane; ///< declared after es_client and checkpoint, so it is drained before they go
+   std::unique_ptr<index_router> action_traces_router;
+   std::shared_ptr<query_api> query; ///< shared with the http handlers, null unless --elastic-api
+
+   static const action_name newaccount;
+   static const action_name setabi;
+   static const action_name updateauth;
+   static const action_name deleteauth;
+   static const action_name transfer;
+   static const permission_name owner;
+   static const permission_name active;
+
+   std::string accounts_index = "accounts";
+   std::string blocks_index = "blocks";
+   std::string trans_index = "transactions";
+   std::string block_states_index = "block_states";
+   std::string trans_traces_index = "transaction_traces";
+   std::string action_traces_index = "action_traces";
+   std::string transfers_index = "transfers";
+   std::string account_actions_index = "account_actions";
+   std::string table_rows_index = "table_rows";
+   std::string table_deltas_index = "table_deltas";
+
+};
+
+}
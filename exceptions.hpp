@@ -15,6 +15,12 @@ FC_DECLARE_DERIVED_EXCEPTION( elasticsearch_exception,    chain_exception,
                                  3230005, "Get non 2XX response code from Elasticsearch" )
    FC_DECLARE_DERIVED_EXCEPTION( bulk_fail_exception,       elasticsearch_exception,
                                  3230006, "Perform bulk get non zero errors" )
+   FC_DECLARE_DERIVED_EXCEPTION( bulk_rejected_exception,   elasticsearch_exception,
+                                 3230009, "Bulk rejected by Elasticsearch, retry later" )
+   FC_DECLARE_DERIVED_EXCEPTION( query_exception,           elasticsearch_exception,
+                                 3230010, "Invalid elasticsearch query parameters" )
+   FC_DECLARE_DERIVED_EXCEPTION( query_overload_exception,  elasticsearch_exception,
+                                 3230011, "Too many elasticsearch queries waiting" )
 FC_DECLARE_DERIVED_EXCEPTION( bulkers_exception,    chain_exception,
                               3230007, "Bulkers exception" )
    FC_DECLARE_DERIVED_EXCEPTION( empty_bulker_pool_exception,   bulkers_exception,
@@ -32,6 +38,10 @@ inline void handle_elasticsearch_exception( const std::string& desc, int line_nu
       } catch( chain::response_code_exception& e) {
          elog( "elasticsearch exception, ${desc}, line ${line}, ${what}",
                ("desc", desc)( "line", line_num )( "what", e.to_detail_string() ));
+      } catch( chain::bulk_rejected_exception& e) {
+         wlog( "elasticsearch exception, ${desc}, line ${line}, ${what}",
+               ("desc", desc)( "line", line_num )( "what", e.to_detail_string() ));
+         shutdown = false;
       } catch( chain::bulk_fail_exception& e) {
          wlog( "elasticsearch exception, ${desc}, line ${line}, ${what}",
                ("desc", desc)( "line", line_num )( "what", e.to_detail_string() ));
@@ -0,0 +1,133 @@
+#include <cstring>
+
+#include "format.hpp"
+#include "json_writer.hpp"
+
+namespace eosio {
+
+namespace {
+
+/// the two hex digits of every byte value
+struct hex_table {
+   char pairs[512];
+
+   hex_table() {
+      static const char digits[] = "0123456789abcdef";
+      for( int i = 0; i < 256; ++i ) {
+         pairs[2 * i] = digits[i >> 4];
+         pairs[2 * i + 1] = digits[i & 0xF];
+      }
+   }
+};
+
+const hex_table hex_digits;
+
+const char name_charmap[] = ".12345abcdefghijklmnopqrstuvwxyz";
+
+void append_bulk_action( std::string& out, const char* op, const std::string& index ) {
+   out.append( "{\"" );
+   out.append( op );
+   out.append( "\":{\"_index\":" );
+   append_json_string( out, index );
+   out.append( ",\"_type\":\"_doc\",\"_id\":" );
+}
+
+void finish_bulk_action( std::string& out, uint32_t retry_on_conflict, const std::string& routing ) {
+   if( retry_on_conflict ) {
+      out.append( ",\"retry_on_conflict\":" );
+      append_uint( out, retry_on_conflict );
+   }
+   if( !routing.empty() ) {
+      out.append( ",\"routing\":" );
+      append_json_string( out, routing );
+   }
+   out.append( "}}" );
+}
+
+}
+
+char* write_hex( char* out, const char* data, size_t size ) {
+   for( size_t i = 0; i < size; ++i ) {
+      std::memcpy( out, hex_digits.pairs + 2 * static_cast<unsigned char>(data[i]), 2 );
+      out += 2;
+   }
+   return out;
+}
+
+char* write_name( char* out, uint64_t n ) {
+   if( n == 0 ) return out;
+   // chars 1-12 take 5 bits each from the top, char 13 the low 4 bits; trailing '.' are zero groups
+   // and trimmed, so the length follows from the lowest set bit
+   size_t length = 13;
+   if( (n & 0xF) == 0 ) {
+      length = (63 - __builtin_ctzll( n )) / 5 + 1;
+   }
+   for( size_t i = 0; i < length && i < 12; ++i ) {
+      out[i] = name_charmap[(n >> (59 - 5 * i)) & 0x1F];
+   }
+   if( length == 13 ) {
+      out[12] = name_charmap[n & 0xF];
+   }
+   return out + length;
+}
+
+char* write_uint( char* out, uint64_t v ) {
+   char buf[20];
+   char* p = buf + sizeof(buf);
+   do {
+      *--p = static_cast<char>( '0' + v % 10 );
+      v /= 10;
+   } while( v );
+   const size_t length = buf + sizeof(buf) - p;
+   std::memcpy( out, p, length );
+   return out + length;
+}
+
+void append_hex( std::string& out, const fc::sha256& id ) {
+   char buf[64];
+   out.append( buf, write_hex( buf, id.data(), sizeof(id._hash) ) - buf );
+}
+
+void append_name( std::string& out, chain::name n ) {
+   char buf[13];
+   out.append( buf, write_name( buf, n.value ) - buf );
+}
+
+void append_uint( std::string& out, uint64_t v ) {
+   char buf[20];
+   out.append( buf, write_uint( buf, v ) - buf );
+}
+
+std::string to_hex_string( const fc::sha256& id ) {
+   char buf[64];
+   return std::string( buf, write_hex( buf, id.data(), sizeof(id._hash) ) );
+}
+
+std::string name_string( chain::name n ) {
+   char buf[13];
+   return std::string( buf, write_name( buf, n.value ) );
+}
+
+std::string bulk_action( const char* op, const std::string& index, const std::string& id,
+                         uint32_t retry_on_conflict, const std::string& routing ) {
+   std::string out;
+   out.reserve( 64 + index.size() + id.size() + routing.size() );
+   append_bulk_action( out, op, index );
+   append_json_string( out, id );
+   finish_bulk_action( out, retry_on_conflict, routing );
+   return out;
+}
+
+std::string bulk_action( const char* op, const std::string& index, uint64_t id,
+                         uint32_t retry_on_conflict, const std::string& routing ) {
+   std::string out;
+   out.reserve( 64 + index.size() + routing.size() );
+   append_bulk_action( out, op, index );
+   out.push_back( '"' );
+   append_uint( out, id );
+   out.push_back( '"' );
+   finish_bulk_action( out, retry_on_conflict, routing );
+   return out;
+}
+
+}
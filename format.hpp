@@ -0,0 +1,44 @@
+#pragma once
+#include <string>
+
+#include <eosio/chain/name.hpp>
+
+#include <fc/crypto/sha256.hpp>
+
+namespace eosio {
+
+/**
+ *  Formatting of the ids and names that go into every document, written into
+ *  stack buffers or straight into the output string instead of the temporaries
+ *  of sha256::str(), name::to_string() and boost::format.
+ */
+
+/// writes data as lowercase hex to out, which has room for 2 * size chars; @return the end of the output
+char* write_hex( char* out, const char* data, size_t size );
+/// writes the string form of n, as name::to_string() returns it, to out which has room for 13 chars; @return the end
+char* write_name( char* out, uint64_t n );
+/// writes v in decimal to out, which has room for 20 chars; @return the end
+char* write_uint( char* out, uint64_t v );
+
+void append_hex( std::string& out, const fc::sha256& id );
+void append_name( std::string& out, chain::name n );
+void append_uint( std::string& out, uint64_t v );
+
+/// @return id as lowercase hex, same as id.str()
+std::string to_hex_string( const fc::sha256& id );
+/// @return n as name::to_string() returns it
+std::string name_string( chain::name n );
+
+/**
+ *  @return the action line of a bulk request, i.e. {"index":{"_index":"blocks","_type":"_doc","_id":"..."}},
+ *  written without building a variant
+ *  @param op index, update or delete
+ *  @param retry_on_conflict left out if 0
+ *  @param routing left out if empty
+ */
+std::string bulk_action( const char* op, const std::string& index, const std::string& id,
+                         uint32_t retry_on_conflict = 0, const std::string& routing = std::string() );
+std::string bulk_action( const char* op, const std::string& index, uint64_t id,
+                         uint32_t retry_on_conflict = 0, const std::string& routing = std::string() );
+
+}
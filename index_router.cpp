@@ -0,0 +1,99 @@
+#include <ctime>
+
+#include <boost/format.hpp>
+
+#include "index_router.hpp"
+#include "exceptions.hpp"
+
+namespace eosio {
+
+index_router::partition_type index_router::parse_partition_type( const std::string &s ) {
+   if ( s == "none" ) {
+      return partition_type::none;
+   } else if ( s == "block" ) {
+      return partition_type::block;
+   } else if ( s == "month" ) {
+      return partition_type::month;
+   }
+   EOS_THROW(chain::plugin_config_exception, "unknown index partition type: ${s}", ("s", s));
+}
+
+std::string index_router::partition_name( uint32_t key ) const {
+   if ( type == partition_type::block ) {
+      return boost::str(boost::format("%1%-%2$06d") % alias % key);
+   }
+   return boost::str(boost::format("%1%-%2$04d.%3$02d") % alias % (key / 100) % (key % 100));
+}
+
+void index_router::check_alias() {
+   if ( type == partition_type::none ) return;
+   std::lock_guard<std::mutex> guard(client_mtx);
+   // HEAD <name> finds indices and aliases, HEAD _alias/<name> only aliases
+   EOS_ASSERT( !es_client.head( alias ) || es_client.head( "_alias/" + alias ), chain::plugin_config_exception,
+               "${a} is an existing index, its name cannot be used as the alias of the partition indices. "
+               "Reindex it into ${a}-old, delete it and add ${a}-old to the alias ${a}, or pass a new "
+               "--elastic-index-action-traces name", ("a", alias) );
+}
+
+void index_router::ensure_index( const std::string &index_name ) {
+   std::lock_guard<std::mutex> guard(client_mtx);
+   es_client.init_index( index_name, "" );
+   es_client.add_alias( index_name, alias );
+   ilog("routing ${a} documents to index ${i}", ("a", alias)("i", index_name));
+}
+
+std::string index_router::get( uint32_t block_num, const chain::block_timestamp_type &block_time ) {
+   if ( type == partition_type::none ) {
+      return alias;
+   }
+
+   uint32_t key;
+   if ( type == partition_type::block ) {
+      key = block_num / blocks_per_index;
+   } else {
+      std::time_t t = fc::time_point_sec( block_time.to_time_point() ).sec_since_epoch();
+      std::tm tm;
+      gmtime_r( &t, &tm );
+      key = (tm.tm_year + 1900) * 100 + tm.tm_mon + 1;
+   }
+
+   {
+      std::unique_lock<std::mutex> lock(mtx);
+      auto it = partitions.find( key );
+      if ( it != partitions.end() ) {
+         return it->second;
+      }
+      // another thread creating the same partition is waited for, creating its index twice could fail
+      created_cv.wait( lock, [this, key]() { return creating.count( key ) == 0; } );
+      it = partitions.find( key );
+      if ( it != partitions.end() ) {
+         return it->second;
+      }
+      creating.insert( key );
+   }
+
+   // without the lock, documents of the existing partitions keep being routed meanwhile
+   auto index_name = partition_name( key );
+   try {
+      ensure_index( index_name );
+   } catch( ... ) {
+      {
+         std::lock_guard<std::mutex> guard(mtx);
+         creating.erase( key );
+      }
+      // a waiting thread tries the creation again
+      created_cv.notify_all();
+      handle_elasticsearch_exception( "create partition index " + index_name, __LINE__ );
+      throw;
+   }
+
+   {
+      std::lock_guard<std::mutex> guard(mtx);
+      creating.erase( key );
+      partitions.emplace( key, index_name );
+   }
+   created_cv.notify_all();
+   return index_name;
+}
+
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <condition_variable>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <eosio/chain/block_timestamp.hpp>
+
+#include "elastic_client.hpp"
+
+namespace eosio {
+
+/**
+ *  Maps a document to a concrete index behind a read alias. With partitioning
+ *  enabled, documents are written to `<alias>-<partition>` indices split either
+ *  by block number range or by block_time month, and every partition index is
+ *  added to `<alias>` so queries keep working against the original name.
+ */
+class index_router
+{
+public:
+   enum class partition_type { none, block, month };
+
+   index_router(const std::string &alias, partition_type type, uint32_t blocks_per_index,
+                const std::vector<std::string> url_list,
+                const std::string &user, const std::string &password):
+      alias(alias), type(type), blocks_per_index(blocks_per_index), es_client(url_list, user, password) {}
+
+   static partition_type parse_partition_type( const std::string &s );
+
+   bool partitioned() const { return type != partition_type::none; }
+
+   /// @throws plugin_config_exception if partitioned and a concrete index already has the name of the alias
+   void check_alias();
+
+   /// @throws the error of creating the partition index, nothing is routed to a partition that could not be created
+   std::string get( uint32_t block_num, const chain::block_timestamp_type &block_time );
+
+private:
+   std::string partition_name( uint32_t key ) const;
+   void ensure_index( const std::string &index_name );
+
+   std::string alias;
+   partition_type type;
+   uint32_t blocks_per_index;
+
+   elastic_client es_client;
+   std::mutex client_mtx; ///< guards es_client, a client is not thread safe
+   std::unordered_map<uint32_t, std::string> partitions;
+   std::unordered_set<uint32_t> creating; ///< partitions whose index is being created by a thread
+   std::mutex mtx; ///< guards partitions and creating, never held during a request
+   std::condition_variable created_cv;
+};
+
+}
@@ -0,0 +1,243 @@
+#include <atomic>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define JSON_WRITER_X86 1
+#endif
+
+#include "json_writer.hpp"
+
+namespace eosio {
+
+namespace {
+
+/// @return true if c is copied to a JSON string as it is
+inline bool plain_char( unsigned char c ) {
+   return c >= 0x20 && c < 0x80 && c != '"' && c != '\\';
+}
+
+size_t plain_prefix_scalar( const char* str, size_t size ) {
+   size_t i = 0;
+   while( i < size && plain_char( static_cast<unsigned char>(str[i]) ) ) ++i;
+   return i;
+}
+
+#ifdef JSON_WRITER_X86
+
+size_t plain_prefix_sse2( const char* str, size_t size ) {
+   const __m128i space = _mm_set1_epi8( 0x20 );
+   const __m128i quote = _mm_set1_epi8( '"' );
+   const __m128i backslash = _mm_set1_epi8( '\\' );
+   size_t i = 0;
+   for( ; i + 16 <= size; i += 16 ) {
+      __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i*>(str + i) );
+      // bytes >= 0x80 are negative as signed bytes, so one compare catches them with the control characters
+      __m128i special = _mm_or_si128( _mm_cmplt_epi8( v, space ),
+                                      _mm_or_si128( _mm_cmpeq_epi8( v, quote ), _mm_cmpeq_epi8( v, backslash ) ) );
+      unsigned mask = static_cast<unsigned>( _mm_movemask_epi8( special ) );
+      if( mask ) return i + __builtin_ctz( mask );
+   }
+   return i + plain_prefix_scalar( str + i, size - i );
+}
+
+__attribute__((target("avx2")))
+size_t plain_prefix_avx2( const char* str, size_t size ) {
+   const __m256i space = _mm256_set1_epi8( 0x20 );
+   const __m256i quote = _mm256_set1_epi8( '"' );
+   const __m256i backslash = _mm256_set1_epi8( '\\' );
+   size_t i = 0;
+   for( ; i + 32 <= size; i += 32 ) {
+      __m256i v = _mm256_loadu_si256( reinterpret_cast<const __m256i*>(str + i) );
+      __m256i special = _mm256_or_si256( _mm256_cmpgt_epi8( space, v ),
+                                         _mm256_or_si256( _mm256_cmpeq_epi8( v, quote ), _mm256_cmpeq_epi8( v, backslash ) ) );
+      unsigned mask = static_cast<unsigned>( _mm256_movemask_epi8( special ) );
+      if( mask ) return i + __builtin_ctz( mask );
+   }
+   return i + plain_prefix_sse2( str + i, size - i );
+}
+
+#endif
+
+using plain_prefix_function = size_t (*)( const char*, size_t );
+
+plain_prefix_function plain_prefix_of( json_string_scan scan ) {
+   switch( scan ) {
+#ifdef JSON_WRITER_X86
+      case json_string_scan::avx2: return plain_prefix_avx2;
+      case json_string_scan::sse2: return plain_prefix_sse2;
+#endif
+      default: return plain_prefix_scalar;
+   }
+}
+
+/// chosen once, replaced only by force_json_string_scan
+std::atomic<plain_prefix_function>& current_plain_prefix() {
+   static std::atomic<plain_prefix_function> f{ plain_prefix_of( supported_json_string_scan() ) };
+   return f;
+}
+
+/// @return the length of the valid UTF-8 sequence starting at str, 0 if it is invalid, overlong or a surrogate
+size_t utf8_sequence_length( const unsigned char* str, size_t size ) {
+   const unsigned char c = str[0];
+   size_t length;
+   unsigned char low = 0x80, high = 0xBF; // range of the second byte
+   if( c >= 0xC2 && c <= 0xDF ) {
+      length = 2;
+   } else if( c >= 0xE0 && c <= 0xEF ) {
+      length = 3;
+      if( c == 0xE0 ) low = 0xA0;
+      else if( c == 0xED ) high = 0x9F;
+   } else if( c >= 0xF0 && c <= 0xF4 ) {
+      length = 4;
+      if( c == 0xF0 ) low = 0x90;
+      else if( c == 0xF4 ) high = 0x8F;
+   } else {
+      return 0;
+   }
+   if( size < length ) return 0;
+   if( str[1] < low || str[1] > high ) return 0;
+   for( size_t i = 2; i < length; ++i ) {
+      if( (str[i] & 0xC0) != 0x80 ) return 0;
+   }
+   return length;
+}
+
+void append_escaped( std::string& out, unsigned char c ) {
+   static const char hex[] = "0123456789abcdef";
+   switch( c ) {
+      case '"':  out.append( "\\\"", 2 ); break;
+      case '\\': out.append( "\\\\", 2 ); break;
+      case '\b': out.append( "\\b", 2 ); break;
+      case '\f': out.append( "\\f", 2 ); break;
+      case '\n': out.append( "\\n", 2 ); break;
+      case '\r': out.append( "\\r", 2 ); break;
+      case '\t': out.append( "\\t", 2 ); break;
+      default: {
+         const char u[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF] };
+         out.append( u, sizeof(u) );
+      }
+   }
+}
+
+void append_quoted( std::string& out, const std::string& str ) {
+   out.push_back( '"' );
+   out.append( str );
+   out.push_back( '"' );
+}
+
+template<typename Object>
+void append_object( std::string& out, const Object& o ) {
+   out.push_back( '{' );
+   bool first = true;
+   for( const auto& entry : o ) {
+      if( !first ) out.push_back( ',' );
+      first = false;
+      append_json_string( out, entry.key() );
+      out.push_back( ':' );
+      append_json( out, entry.value() );
+   }
+   out.push_back( '}' );
+}
+
+}
+
+json_string_scan supported_json_string_scan() {
+#ifdef JSON_WRITER_X86
+   __builtin_cpu_init();
+   if( __builtin_cpu_supports( "avx2" ) ) return json_string_scan::avx2;
+   return json_string_scan::sse2;
+#else
+   return json_string_scan::scalar;
+#endif
+}
+
+void force_json_string_scan( json_string_scan scan ) {
+   current_plain_prefix().store( plain_prefix_of( scan ), std::memory_order_relaxed );
+}
+
+void append_json_string( std::string& out, const char* str, size_t size ) {
+   const plain_prefix_function plain_prefix = current_plain_prefix().load( std::memory_order_relaxed );
+
+   out.reserve( out.size() + size + 2 );
+   out.push_back( '"' );
+   size_t i = 0;
+   while( i < size ) {
+      size_t plain = plain_prefix( str + i, size - i );
+      out.append( str + i, plain );
+      i += plain;
+      if( i == size ) break;
+
+      const auto c = static_cast<unsigned char>( str[i] );
+      if( c < 0x80 ) {
+         append_escaped( out, c );
+         ++i;
+         continue;
+      }
+      size_t length = utf8_sequence_length( reinterpret_cast<const unsigned char*>(str + i), size - i );
+      if( length ) {
+         out.append( str + i, length );
+         i += length;
+      } else {
+         ++i; // dropped, the rest is checked again from the next byte
+      }
+   }
+   out.push_back( '"' );
+}
+
+void append_json( std::string& out, const fc::variant& v ) {
+   switch( v.get_type() ) {
+      case fc::variant::null_type:
+         out.append( "null", 4 );
+         break;
+      case fc::variant::int64_type: {
+         int64_t i = v.as_int64();
+         if( i > 0xffffffff ) append_quoted( out, std::to_string( i ) );
+         else out.append( std::to_string( i ) );
+         break;
+      }
+      case fc::variant::uint64_type: {
+         uint64_t i = v.as_uint64();
+         if( i > 0xffffffff ) append_quoted( out, std::to_string( i ) );
+         else out.append( std::to_string( i ) );
+         break;
+      }
+      case fc::variant::double_type:
+         append_quoted( out, v.as_string() );
+         break;
+      case fc::variant::bool_type:
+         if( v.as_bool() ) out.append( "true", 4 );
+         else out.append( "false", 5 );
+         break;
+      case fc::variant::string_type:
+         append_json_string( out, v.get_string() );
+         break;
+      case fc::variant::blob_type:
+         append_json_string( out, v.as_string() );
+         break;
+      case fc::variant::array_type: {
+         out.push_back( '[' );
+         bool first = true;
+         for( const auto& e : v.get_array() ) {
+            if( !first ) out.push_back( ',' );
+            first = false;
+            append_json( out, e );
+         }
+         out.push_back( ']' );
+         break;
+      }
+      case fc::variant::object_type:
+         append_object( out, v.get_object() );
+         break;
+   }
+}
+
+void append_json( std::string& out, const fc::variant_object& o ) {
+   append_object( out, o );
+}
+
+void append_json( std::string& out, const fc::mutable_variant_object& o ) {
+   append_object( out, o );
+}
+
+}
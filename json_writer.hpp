@@ -0,0 +1,43 @@
+#pragma once
+#include <string>
+
+#include <fc/variant.hpp>
+#include <fc/variant_object.hpp>
+
+namespace eosio {
+
+/**
+ *  Appends str to out as a quoted JSON string. Quotes, backslashes and control
+ *  characters are escaped, and bytes that are not part of valid UTF-8 are
+ *  dropped the way fc::prune_invalid_utf8 drops them. Runs of plain ASCII are
+ *  scanned 32 bytes at a time with AVX2 or 16 with SSE2, chosen at runtime.
+ */
+void append_json_string( std::string& out, const char* str, size_t size );
+
+inline void append_json_string( std::string& out, const std::string& str ) {
+   append_json_string( out, str.data(), str.size() );
+}
+
+/// ways append_json_string can scan for plain ASCII
+enum class json_string_scan { scalar, sse2, avx2 };
+
+/// @return the fastest scan the cpu supports, the one used unless another is forced
+json_string_scan supported_json_string_scan();
+
+/// makes append_json_string use scan, for tests; it must be supported by the cpu
+void force_json_string_scan( json_string_scan scan );
+
+/// appends v as JSON, formatted like fc::json::to_string with large integers and doubles as strings
+void append_json( std::string& out, const fc::variant& v );
+void append_json( std::string& out, const fc::variant_object& o );
+void append_json( std::string& out, const fc::mutable_variant_object& o );
+
+/// @return the same document as fc::prune_invalid_utf8( fc::json::to_string( v ) ), in a single pass
+template<typename T>
+std::string to_json( const T& v ) {
+   std::string out;
+   append_json( out, v );
+   return out;
+}
+
+}
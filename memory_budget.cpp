@@ -0,0 +1,91 @@
+#include <algorithm>
+#include <chrono>
+
+#include <fc/log/logger.hpp>
+
+#include "memory_budget.hpp"
+
+namespace eosio {
+
+constexpr std::chrono::milliseconds memory_budget::stall_timeout;
+
+memory_credit::~memory_credit() {
+   if ( retained ) budget.release_retained( bytes );
+   else budget.release( bytes );
+}
+
+void memory_credit::retain() {
+   if ( retained ) return;
+   budget.retain( bytes );
+   retained = true;
+}
+
+memory_credit_ptr memory_budget::acquire( size_t bytes ) {
+   std::unique_lock<std::mutex> lock(mtx);
+   auto admitted = [this, bytes]() { return admitted_locked( bytes ); };
+   if ( !admitted() ) {
+      ++waiting;
+      if ( stall_handler && !cv.wait_for( lock, stall_timeout, admitted ) ) {
+         // the credits may sit in bulk bodies that only the next documents would fill and send
+         lock.unlock();
+         stall_handler();
+         lock.lock();
+      }
+      // logs only once per long wait to show why the chain thread is held back
+      if ( !cv.wait_for( lock, std::chrono::seconds(10), admitted ) ) {
+         wlog("waiting for memory budget, used: ${u} of ${c} bytes, ${r} of them by reversible blocks",
+              ("u", in_use)("c", capacity)("r", retained));
+         cv.wait( lock, admitted );
+      }
+      --waiting;
+   }
+   in_use += bytes;
+   return std::make_shared<memory_credit>( *this, bytes );
+}
+
+bool memory_budget::admitted_locked( size_t bytes ) const {
+   const auto pipeline = in_use - retained;
+   // with nothing in the pipeline no wait would free any bytes
+   return pipeline == 0 || pipeline + std::min( retained, max_retained ) + bytes <= capacity;
+}
+
+void memory_budget::consume( size_t bytes ) {
+   std::lock_guard<std::mutex> guard(mtx);
+   in_use += bytes;
+}
+
+void memory_budget::release( size_t bytes ) {
+   bool notify = false;
+   {
+      std::lock_guard<std::mutex> guard(mtx);
+      in_use -= std::min( in_use, bytes );
+      notify = waiting > 0;
+   }
+   if ( notify ) cv.notify_all();
+}
+
+void memory_budget::retain( size_t bytes ) {
+   bool notify = false;
+   {
+      std::lock_guard<std::mutex> guard(mtx);
+      retained += bytes;
+      notify = waiting > 0;
+   }
+   // retained bytes above max_retained stop counting
+   if ( notify ) cv.notify_all();
+}
+
+void memory_budget::release_retained( size_t bytes ) {
+   {
+      std::lock_guard<std::mutex> guard(mtx);
+      retained -= std::min( retained, bytes );
+   }
+   release( bytes );
+}
+
+size_t memory_budget::used() const {
+   std::lock_guard<std::mutex> guard(mtx);
+   return in_use;
+}
+
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+namespace eosio {
+
+class memory_budget;
+
+/// bytes taken from a memory_budget, returned when the credit is destroyed
+class memory_credit
+{
+public:
+   memory_credit(memory_budget& budget, size_t bytes): budget(budget), bytes(bytes) {}
+   ~memory_credit();
+
+   memory_credit(const memory_credit&) = delete;
+   memory_credit& operator=(const memory_credit&) = delete;
+
+   /**
+    *  The bytes stay with data kept for later, like the buffers of reversible
+    *  blocks. Retained bytes count up to half of the budget, the rest of it is
+    *  left to the pipeline, so the buffers cannot hold back the blocks that
+    *  release them.
+    */
+   void retain();
+
+private:
+   memory_budget& budget;
+   const size_t bytes;
+   bool retained = false;
+};
+
+using memory_credit_ptr = std::shared_ptr<memory_credit>;
+
+/**
+ *  Bounds the memory held by the pipeline: entries waiting in the signal queues,
+ *  the thread pool tasks created from them and the bulk bodies waiting to be sent
+ *  all hold credits of one budget. Producers block until enough credits are
+ *  returned, so indexing runs at the rate elasticsearch drains the bulk bodies.
+ */
+class memory_budget
+{
+public:
+   explicit memory_budget(size_t capacity): capacity(capacity), max_retained(capacity / 2) {}
+
+   /// blocks until bytes are available; a budget holding nothing but retained bytes admits any size so large entries cannot stall
+   memory_credit_ptr acquire( size_t bytes );
+
+   /**
+    *  handler is called by acquire when it waited stall_timeout, without the lock,
+    *  on the thread that waits. It has to return at once and only ask another
+    *  thread to send the partly filled bulk bodies, which are otherwise held until
+    *  more documents fill them. Set before the budget is used.
+    */
+   void set_stall_handler( std::function<void()> handler ) { stall_handler = std::move(handler); }
+
+   /// takes bytes without waiting, for stages that have to finish to return credits
+   void consume( size_t bytes );
+   void release( size_t bytes );
+
+   size_t get_capacity() const { return capacity; }
+   size_t used() const;
+
+   static constexpr std::chrono::milliseconds stall_timeout{500};
+
+private:
+   friend class memory_credit;
+
+   void retain( size_t bytes );
+   void release_retained( size_t bytes );
+   bool admitted_locked( size_t bytes ) const;
+
+   const size_t capacity;
+   const size_t max_retained; ///< retained bytes above it are not charged
+   size_t in_use = 0;
+   size_t retained = 0; ///< part of in_use
+   size_t waiting = 0;
+   std::function<void()> stall_handler;
+
+   mutable std::mutex mtx;
+   std::condition_variable cv;
+};
+
+}
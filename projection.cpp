@@ -0,0 +1,56 @@
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
+
+#include "projection.hpp"
+#include "exceptions.hpp"
+
+namespace eosio {
+
+field_projection field_projection::parse( const std::string &spec ) {
+   field_projection p;
+   std::vector<std::string> paths;
+   boost::split( paths, spec, boost::is_any_of( "," ) );
+   for( auto &path : paths ) {
+      boost::trim( path );
+      if( path.empty() ) continue;
+      p.add( path );
+   }
+   return p;
+}
+
+void field_projection::add( const std::string &path ) {
+   auto pos = path.find( '.' );
+   auto name = path.substr( 0, pos );
+   EOS_ASSERT( !name.empty(), chain::plugin_config_exception, "invalid field path: ${p}", ("p", path) );
+
+   if( select_all ) {
+      // the first path turns "everything" into a whitelist
+      select_all = false;
+      fields.clear();
+   }
+
+   auto itr = fields.find( name );
+   if( pos == std::string::npos ) {
+      // the whole field, overrides any nested selection
+      fields[name] = field_projection();
+   } else if( itr == fields.end() ) {
+      field_projection child;
+      child.add( path.substr( pos + 1 ) );
+      fields.emplace( name, std::move(child) );
+   } else if( !itr->second.all() ) {
+      itr->second.add( path.substr( pos + 1 ) );
+   }
+}
+
+const field_projection* field_projection::find( const std::string &name ) const {
+   static const field_projection everything;
+
+   if( excluded.count( name ) ) return nullptr;
+   if( select_all ) return &everything;
+
+   auto itr = fields.find( name );
+   return itr != fields.end() ? &itr->second : nullptr;
+}
+
+}
@@ -0,0 +1,124 @@
+#pragma once
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <type_traits>
+
+#include <eosio/chain/action.hpp>
+#include <eosio/chain/transaction.hpp>
+
+#include <fc/reflect/reflect.hpp>
+#include <fc/variant.hpp>
+#include <fc/variant_object.hpp>
+
+namespace eosio {
+
+/**
+ *  A whitelist of document fields compiled from a comma separated list of
+ *  dotted paths, e.g. `block_num,header.producer,header.timestamp`. It is used
+ *  while converting an object to a variant, so fields that are not selected are
+ *  never materialized. Paths descend into reflected structs only; arrays,
+ *  variants and actions are always converted as a whole.
+ */
+class field_projection
+{
+public:
+   /// selects every field
+   field_projection() = default;
+
+   static field_projection parse( const std::string &spec );
+
+   /// never select the field name, whatever the whitelist says
+   void exclude( const std::string &name ) { excluded.insert( name ); }
+
+   bool all() const { return select_all && excluded.empty(); }
+
+   /// @return the projection of the members of field name, nullptr if it is not selected
+   const field_projection* find( const std::string &name ) const;
+
+private:
+   void add( const std::string &path );
+
+   bool select_all = true;
+   std::map<std::string, field_projection> fields;
+   std::set<std::string> excluded;
+};
+
+/// converts without an abi, e.g. for block_state
+struct to_plain_variant {
+   template<typename T>
+   fc::variant operator()( const T &obj ) const {
+      fc::variant v;
+      fc::to_variant( obj, v );
+      return v;
+   }
+};
+
+/// @return obj converted by convert, limited to the fields selected by p
+template<typename T, typename Convert>
+fc::variant project( const T &obj, const field_projection &p, const Convert &convert );
+template<typename T, typename Convert>
+fc::variant project( const std::shared_ptr<T> &obj, const field_projection &p, const Convert &convert );
+template<typename Convert>
+fc::variant project( const chain::action &obj, const field_projection &p, const Convert &convert );
+template<typename Convert>
+fc::variant project( const chain::packed_transaction &obj, const field_projection &p, const Convert &convert );
+
+namespace detail {
+
+template<typename T, typename Convert>
+struct projection_visitor {
+   const T &obj;
+   const field_projection &p;
+   const Convert &convert;
+   fc::mutable_variant_object &mvo;
+
+   template<typename Member, class Class, Member (Class::*member)>
+   void operator()( const char *name ) const {
+      const field_projection* child = p.find( name );
+      if( child ) {
+         mvo( name, eosio::project( obj.*member, *child, convert ) );
+      }
+   }
+};
+
+template<typename T, typename Convert>
+fc::variant project( const T &obj, const field_projection &p, const Convert &convert, std::false_type ) {
+   return convert( obj );
+}
+
+template<typename T, typename Convert>
+fc::variant project( const T &obj, const field_projection &p, const Convert &convert, std::true_type ) {
+   fc::mutable_variant_object mvo;
+   fc::reflector<T>::visit( projection_visitor<T, Convert>{obj, p, convert, mvo} );
+   return fc::variant( std::move(mvo) );
+}
+
+}
+
+template<typename T, typename Convert>
+fc::variant project( const std::shared_ptr<T> &obj, const field_projection &p, const Convert &convert ) {
+   if( !obj ) return fc::variant();
+   return project( *obj, p, convert );
+}
+
+/// the abi serializer decodes action data and packed transactions as a whole
+template<typename Convert>
+fc::variant project( const chain::action &obj, const field_projection &p, const Convert &convert ) {
+   return convert( obj );
+}
+
+template<typename Convert>
+fc::variant project( const chain::packed_transaction &obj, const field_projection &p, const Convert &convert ) {
+   return convert( obj );
+}
+
+template<typename T, typename Convert>
+fc::variant project( const T &obj, const field_projection &p, const Convert &convert ) {
+   if( p.all() ) return convert( obj );
+   return detail::project( obj, p, convert,
+                           std::integral_constant<bool, fc::reflector<T>::is_defined::value>() );
+}
+
+}
@@ -0,0 +1,268 @@
+#include <algorithm>
+
+#include <eosio/chain/types.hpp>
+
+#include <fc/io/json.hpp>
+#include <fc/log/logger.hpp>
+#include <fc/variant_object.hpp>
+
+#include "query_api.hpp"
+#include "exceptions.hpp"
+#include "format.hpp"
+
+namespace eosio {
+
+namespace {
+
+/// settled block updates closer than this are merged
+const auto settled_granularity = std::chrono::milliseconds(100);
+
+const fc::variants& search_hits( const fc::variant& res ) {
+   return res["hits"]["hits"].get_array();
+}
+
+/// @return the block_num of a document, 0 if it was not stored
+uint64_t block_num_of( const fc::variant_object& source ) {
+   auto itr = source.find( "block_num" );
+   return itr != source.end() ? itr->value().as_uint64() : 0;
+}
+
+std::string ids_query( const std::string& id ) {
+   return fc::json::to_string( fc::mutable_variant_object( "query",
+            fc::mutable_variant_object( "ids", fc::mutable_variant_object( "values", fc::variants{ fc::variant(id) } ) ) ) );
+}
+
+}
+
+query_api::query_api(size_t threads, size_t cache_size, std::chrono::milliseconds refresh_delay, bool route_action_traces,
+                     const index_names& indices,
+                     const std::vector<std::string>& url_list, const std::string& user, const std::string& password):
+   cache_size(cache_size), refresh_delay(refresh_delay), route_action_traces(route_action_traces), indices(indices)
+{
+   for ( size_t i = 0; i < std::max<size_t>( threads, 1 ); ++i ) {
+      clients.emplace_back( new elastic_client(url_list, user, password) );
+   }
+   for ( size_t i = 0; i < clients.size(); ++i ) {
+      this->threads.emplace_back( [this, i]() { worker( i ); } );
+   }
+}
+
+query_api::~query_api() {
+   {
+      std::lock_guard<std::mutex> guard(mtx);
+      done = true;
+   }
+   cv.notify_all();
+   for ( auto& t : threads ) {
+      t.join();
+   }
+}
+
+void query_api::get_actions( const fc::variant& params, callback cb ) {
+   const auto& p = params.get_object();
+   EOS_ASSERT( p.contains( "account_name" ), chain::query_exception, "account_name is required" );
+   const auto receiver = name_string( chain::name( p["account_name"].as_string() ) );
+   const uint64_t limit = p.contains( "limit" ) ? p["limit"].as_uint64() : 20;
+   EOS_ASSERT( limit > 0 && limit <= 100, chain::query_exception, "limit must be between 1 and 100" );
+   fc::optional<uint64_t> before;
+   if ( p.contains( "before" ) ) before = p["before"].as_uint64();
+
+   std::string key = "get_actions ";
+   key.append( receiver ).push_back( ' ' );
+   append_uint( key, limit );
+   if ( before ) {
+      key.push_back( ' ' );
+      append_uint( key, *before );
+   }
+
+   submit( key, [this, receiver, limit, before]( elastic_client& client, uint32_t settled_block, bool& cacheable ) {
+      fc::variants filter;
+      filter.emplace_back( fc::mutable_variant_object( "term", fc::mutable_variant_object( "receipt.receiver", receiver ) ) );
+      if ( before ) {
+         // the anchor itself is fetched too, its block tells whether the page below it is complete
+         filter.emplace_back( fc::mutable_variant_object( "range",
+                                 fc::mutable_variant_object( "receipt.global_sequence", fc::mutable_variant_object( "lte", *before ) ) ) );
+      }
+      auto query = fc::json::to_string( fc::mutable_variant_object
+         ( "size", limit + (before ? 1 : 0) )
+         ( "sort", fc::variants{ fc::mutable_variant_object( "receipt.global_sequence", "desc" ) } )
+         ( "query", fc::mutable_variant_object( "bool", fc::mutable_variant_object( "filter", filter ) ) ) );
+
+      fc::variant res;
+      // all actions received by the account are on the shard of its routing
+      client.search( indices.action_traces, res, query, route_action_traces ? receiver : std::string() );
+
+      fc::variants actions;
+      bool anchor_settled = false;
+      for ( const auto& hit : search_hits( res ) ) {
+         const auto& source = hit["_source"].get_object();
+         if ( before && actions.empty() && !anchor_settled && source.contains( "receipt" ) ) {
+            const auto& receipt = source["receipt"].get_object();
+            if ( receipt.contains( "global_sequence" ) && receipt["global_sequence"].as_uint64() == *before ) {
+               // every action of the account below a settled one is settled as well
+               const auto block_num = block_num_of( source );
+               anchor_settled = block_num > 0 && block_num <= settled_block;
+               continue;
+            }
+         }
+         if ( actions.size() < limit ) actions.emplace_back( source );
+      }
+      cacheable = anchor_settled;
+      return fc::variant( fc::mutable_variant_object( "actions", std::move(actions) ) );
+   }, std::move(cb) );
+}
+
+void query_api::get_transaction( const fc::variant& params, callback cb ) {
+   const auto& p = params.get_object();
+   EOS_ASSERT( p.contains( "id" ), chain::query_exception, "id is required" );
+   const auto id = to_hex_string( chain::transaction_id_type( p["id"].as_string() ) );
+
+   submit( "get_transaction " + id, [this, id]( elastic_client& client, uint32_t settled_block, bool& cacheable ) {
+      fc::variant res;
+      client.search( indices.transactions + "," + indices.transaction_traces, res, ids_query( id ) );
+
+      fc::variant trx;
+      fc::variant trace;
+      for ( const auto& hit : search_hits( res ) ) {
+         if ( hit["_index"].as_string() == indices.transaction_traces ) {
+            trace = hit["_source"];
+         } else {
+            trx = hit["_source"];
+         }
+      }
+      // the transactions document is final too once the trace's block is settled
+      const auto block_num = trace.is_object() ? block_num_of( trace.get_object() ) : 0;
+      cacheable = block_num > 0 && block_num <= settled_block;
+      return fc::variant( fc::mutable_variant_object( "id", id )( "trx", std::move(trx) )( "trace", std::move(trace) ) );
+   }, std::move(cb) );
+}
+
+void query_api::get_account( const fc::variant& params, callback cb ) {
+   const auto& p = params.get_object();
+   EOS_ASSERT( p.contains( "account_name" ), chain::query_exception, "account_name is required" );
+   const auto account = chain::name( p["account_name"].as_string() );
+
+   // the accounts document changes with every permission update, it is never cached
+   submit( "get_account " + name_string( account ), [this, account]( elastic_client& client, uint32_t, bool& ) {
+      fc::variant res;
+      client.search( indices.accounts, res, ids_query( std::to_string( account.value ) ) );
+
+      fc::variant doc;
+      const auto& hits = search_hits( res );
+      if ( !hits.empty() ) doc = hits.front()["_source"];
+      return fc::variant( fc::mutable_variant_object( "account", std::move(doc) ) );
+   }, std::move(cb) );
+}
+
+void query_api::set_settled_block( uint32_t block_num ) {
+   const auto now = clock::now();
+   std::lock_guard<std::mutex> guard(mtx);
+   if ( !settled_updates.empty() ) {
+      auto& last = settled_updates.back();
+      if ( last.second >= block_num ) return;
+      if ( now - last.first < settled_granularity ) {
+         last.second = block_num;
+         return;
+      }
+   }
+   settled_updates.emplace_back( now, block_num );
+}
+
+uint32_t query_api::settled_block_locked( clock::time_point now ) {
+   while ( !settled_updates.empty() && settled_updates.front().first + refresh_delay <= now ) {
+      settled = settled_updates.front().second;
+      settled_updates.pop_front();
+   }
+   return settled;
+}
+
+void query_api::submit( const std::string& key, query run, callback cb ) {
+   std::unique_lock<std::mutex> lock(mtx);
+   auto cached = cache.find( key );
+   if ( cached != cache.end() ) {
+      lru.splice( lru.begin(), lru, cached->second.second );
+      fc::variant result = cached->second.first;
+      lock.unlock();
+      cb( nullptr, result );
+      return;
+   }
+
+   auto itr = in_flight.find( key );
+   if ( itr != in_flight.end() ) {
+      itr->second->callbacks.emplace_back( std::move(cb) );
+      return;
+   }
+
+   EOS_ASSERT( waiting.size() < max_pending_queries, chain::query_overload_exception,
+               "${n} elasticsearch queries are waiting, try again later", ("n", waiting.size()) );
+   auto pending = std::make_shared<pending_query>();
+   pending->run = std::move(run);
+   pending->callbacks.emplace_back( std::move(cb) );
+   in_flight.emplace( key, pending );
+   waiting.emplace_back( key, std::move(pending) );
+   lock.unlock();
+   cv.notify_one();
+}
+
+void query_api::worker( size_t self ) {
+   auto& client = *clients[self];
+   while ( true ) {
+      std::pair<std::string, std::shared_ptr<pending_query>> job;
+      uint32_t settled_block = 0;
+      {
+         std::unique_lock<std::mutex> lock(mtx);
+         cv.wait( lock, [this]() { return done || !waiting.empty(); } );
+         if ( waiting.empty() ) return;
+         job = std::move( waiting.front() );
+         waiting.pop_front();
+         // taken before the search, so nothing written after it counts as settled
+         settled_block = settled_block_locked( clock::now() );
+      }
+
+      fc::variant result;
+      std::exception_ptr error;
+      bool cacheable = false;
+      try {
+         result = job.second->run( client, settled_block, cacheable );
+      } catch ( ... ) {
+         error = std::current_exception();
+      }
+
+      std::vector<callback> callbacks;
+      {
+         std::lock_guard<std::mutex> guard(mtx);
+         if ( !error && cacheable ) cache_locked( job.first, result );
+         in_flight.erase( job.first );
+         callbacks = std::move( job.second->callbacks );
+      }
+      for ( auto& cb : callbacks ) {
+         try {
+            cb( error, result );
+         } catch ( const fc::exception& e ) {
+            elog("query callback: ${e}", ("e", e.to_detail_string()));
+         } catch ( const std::exception& e ) {
+            elog("query callback: ${e}", ("e", e.what()));
+         } catch ( ... ) {
+            elog("query callback: unknown exception");
+         }
+      }
+   }
+}
+
+void query_api::cache_locked( const std::string& key, const fc::variant& result ) {
+   if ( cache_size == 0 ) return;
+   auto itr = cache.find( key );
+   if ( itr != cache.end() ) {
+      itr->second.first = result;
+      lru.splice( lru.begin(), lru, itr->second.second );
+      return;
+   }
+   lru.push_front( key );
+   cache.emplace( key, std::make_pair( result, lru.begin() ) );
+   while ( cache.size() > cache_size ) {
+      cache.erase( lru.back() );
+      lru.pop_back();
+   }
+}
+
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fc/variant.hpp>
+
+#include "elastic_client.hpp"
+
+namespace eosio {
+
+/**
+ *  Read-only history queries answered from the indices the plugin writes.
+ *
+ *  Queries run on their own threads, each with its own elasticsearch client,
+ *  so a slow search never holds the thread that called. Identical queries
+ *  arriving while one is running wait for its result instead of querying
+ *  again. Results made only of blocks that are irreversible and acknowledged
+ *  by elasticsearch cannot change anymore and are kept in a small cache.
+ */
+class query_api
+{
+public:
+   /// called with the error of the query or, if there is none, its result, on a query thread unless it was cached
+   using callback = std::function<void( std::exception_ptr error, const fc::variant& result )>;
+
+   struct index_names {
+      std::string accounts;
+      std::string transactions;
+      std::string transaction_traces;
+      std::string action_traces;
+   };
+
+   /**
+    *  @param cache_size the number of results kept, 0 to cache nothing
+    *  @param refresh_delay how long after being acknowledged documents become visible to search
+    *  @param route_action_traces action traces are routed to shards by receiver
+    */
+   query_api(size_t threads, size_t cache_size, std::chrono::milliseconds refresh_delay, bool route_action_traces,
+             const index_names& indices,
+             const std::vector<std::string>& url_list, const std::string& user, const std::string& password);
+   /// answers the waiting queries before the threads are joined
+   ~query_api();
+
+   /// params: account_name, before (optional global_sequence, exclusive), limit (default 20, at most 100)
+   /// @return newest actions received by account_name first
+   void get_actions( const fc::variant& params, callback cb );
+   /// params: id
+   void get_transaction( const fc::variant& params, callback cb );
+   /// params: account_name
+   void get_account( const fc::variant& params, callback cb );
+
+   /**
+    *  Blocks up to block_num have all their documents written, usually the
+    *  acknowledged checkpoint. Results are cached only below the last such block
+    *  reported refresh_delay ago, when the documents are visible to search.
+    */
+   void set_settled_block( uint32_t block_num );
+
+private:
+   using clock = std::chrono::steady_clock;
+
+   /// runs a search, sets cacheable if the result can be kept
+   using query = std::function<fc::variant( elastic_client& client, uint32_t settled_block, bool& cacheable )>;
+
+   struct pending_query {
+      query run;
+      std::vector<callback> callbacks; ///< of every caller of the same query
+   };
+
+   static const size_t max_pending_queries = 1024;
+
+   void submit( const std::string& key, query run, callback cb );
+   void worker( size_t self );
+   uint32_t settled_block_locked( clock::time_point now );
+   void cache_locked( const std::string& key, const fc::variant& result );
+
+   const size_t cache_size;
+   const std::chrono::milliseconds refresh_delay;
+   const bool route_action_traces;
+   const index_names indices;
+   std::vector<std::unique_ptr<elastic_client>> clients; ///< one per thread, a client is not thread safe
+
+   std::unordered_map<std::string, std::shared_ptr<pending_query>> in_flight;
+   std::deque<std::pair<std::string, std::shared_ptr<pending_query>>> waiting;
+
+   std::unordered_map<std::string, std::pair<fc::variant, std::list<std::string>::iterator>> cache;
+   std::list<std::string> lru; ///< cached keys, most recently used first
+
+   std::deque<std::pair<clock::time_point, uint32_t>> settled_updates;
+   uint32_t settled = 0;
+
+   bool done = false;
+   std::mutex mtx;
+   std::condition_variable cv;
+   std::vector<std::thread> threads;
+};
+
+}
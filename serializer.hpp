@@ -2,6 +2,17 @@
 #include <eosio/chain/multi_index_includes.hpp>
 #include <eosio/chain/database_utils.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
 using namespace eosio;
 using namespace chainbase;
 
@@ -32,41 +43,207 @@ using abi_cache_index_t = chainbase::shared_multi_index_container<abi_cache,
 CHAINBASE_SET_INDEX_TYPE( abi_cache, abi_cache_index_t )
 
 
+/// decode time and failures of the actions and table rows of one contract
+struct abi_decode_stats {
+   uint64_t decodes = 0;
+   uint64_t total_us = 0;
+   uint64_t max_us = 0;
+   uint64_t slow = 0;
+   uint64_t failures = 0;
+   bool tripped = false; ///< data is left as hex until the contract sets a new abi
+};
+
+/**
+ *  What the resolvers passed to abi_serializer::to_variant return: the cached
+ *  abi_serializer itself, where an optional<abi_serializer> would copy all its
+ *  type maps for every action. Keeps the abi alive while it is used, even if a
+ *  setabi evicts it from the cache meanwhile.
+ */
+class resolved_abi {
+public:
+   resolved_abi() = default;
+   /// @param timing destroyed with the last copy of this, which abi_serializer drops once the action is decoded
+   explicit resolved_abi( std::shared_ptr<const abi_serializer> abis, std::shared_ptr<void> timing = nullptr ):
+      abis(std::move(abis)), timing(std::move(timing)) {}
+
+   bool valid() const { return abis != nullptr; }
+   const abi_serializer* operator->() const { return abis.get(); }
+   const abi_serializer& operator*() const { return *abis; }
+
+private:
+   std::shared_ptr<const abi_serializer> abis;
+   std::shared_ptr<void> timing;
+};
+
+/**
+ *  Decodes chain data with the abis of its contracts. The abis are stored in a
+ *  chainbase database next to the node's data, and the abi_serializers built
+ *  from them are kept in a least recently used cache, so a contract's abi is
+ *  not parsed and validated again for every action.
+ *
+ *  How often each abi is used is saved when the serializer is destroyed, so
+ *  the next run can decode the busiest contracts before the first block.
+ *  All members may be called from any thread.
+ */
 class serializer
 {
 public:
-   serializer(const bfs::path& dir, fc::microseconds abi_serializer_max_time, uint64_t db_size)
-      :db(dir, database::read_write, db_size), abi_serializer_max_time(abi_serializer_max_time)
+   /// @param cache_size the number of decoded abis kept in memory
+   serializer(const bfs::path& dir, fc::microseconds abi_serializer_max_time, uint64_t db_size, size_t cache_size = 1024)
+      :db(dir, database::read_write, db_size), abi_serializer_max_time(abi_serializer_max_time),
+       usage_file(dir / "abi_usage"), cache_size(cache_size)
    {
       db.add_index<abi_cache_index_t>();
+      load_usage();
    }
 
-   optional<abi_serializer> get_abi_serializer( const account_name &name ) {
-      if( name.good() ) {
-         try {
-            const auto& a = db.get<abi_cache, by_account>(name);
-            abi_def abi;
-            if( abi_serializer::to_abi( a.abi, abi ))
-               return abi_def_to_serializer(name, abi);
-         } catch( std::out_of_range& e) {
-           // ignore missing abi exception.
-         } FC_CAPTURE_AND_LOG((name))
+   ~serializer() {
+      save_usage();
+      log_worst_decoders( 10 );
+   }
+
+   /// @return the decoded abi of name in the abi database, null if it has none
+   std::shared_ptr<const abi_serializer> get_abi_serializer( const account_name &name ) {
+      return get_decoded( name, true );
+   }
+
+   /// decodes the count most used abis of the previous runs into the cache, on threads in parallel
+   void warm_up( size_t count, size_t threads ) {
+      std::vector<account_name> accounts;
+      {
+         std::lock_guard<std::mutex> guard(mtx);
+         std::vector<std::pair<uint64_t, uint64_t>> ranked( uses.begin(), uses.end() ); // (account, uses)
+         std::sort( ranked.begin(), ranked.end(), []( const auto& a, const auto& b ) { return a.second > b.second; } );
+         ranked.resize( std::min( ranked.size(), std::min( count, cache_size ) ) );
+         for( const auto& r : ranked ) accounts.emplace_back( r.first );
       }
-      return optional<abi_serializer>();
+      if( accounts.empty() ) return;
+
+      std::atomic<size_t> next{0};
+      std::vector<std::thread> workers;
+      for( size_t i = 0; i < std::min( std::max<size_t>( threads, 1 ), accounts.size() ); ++i ) {
+         workers.emplace_back( [&]() {
+            for( size_t j = next++; j < accounts.size(); j = next++ ) {
+               get_decoded( accounts[j], false );
+            }
+         } );
+      }
+      for( auto& w : workers ) w.join();
+      ilog("decoded ${n} abis in advance", ("n", accounts.size()));
    }
 
+   /**
+    *  A contract whose decodes fail or take longer than slow_time max_slow_decodes
+    *  times is decoded without its abi from then on, i.e. its data is stored as hex,
+    *  until it sets a new abi. Never if max_slow_decodes is 0.
+    */
+   void set_circuit_breaker( fc::microseconds slow_time, uint32_t max_slow_decodes ) {
+      std::lock_guard<std::mutex> guard(stats_mtx);
+      slow_decode_time = slow_time;
+      this->max_slow_decodes = max_slow_decodes;
+   }
+
+   /// @return at most count contracts with the most decode time, most first
+   std::vector<std::pair<account_name, abi_decode_stats>> worst_decoders( size_t count ) {
+      std::vector<std::pair<account_name, abi_decode_stats>> worst;
+      {
+         std::lock_guard<std::mutex> guard(stats_mtx);
+         for( const auto& s : decode_stats ) worst.emplace_back( account_name( s.first ), s.second );
+      }
+      std::sort( worst.begin(), worst.end(), []( const auto& a, const auto& b ) { return a.second.total_us > b.second.total_us; } );
+      if( worst.size() > count ) worst.resize( count );
+      return worst;
+   }
+
+   void log_worst_decoders( size_t count ) {
+      for( const auto& w : worst_decoders( count ) ) {
+         const auto& s = w.second;
+         ilog("abi decode of ${a}: ${d} decodes, ${t}us total, ${m}us max, ${s} slow, ${f} failed${x}",
+              ("a", w.first)("d", s.decodes)("t", s.total_us)("m", s.max_us)("s", s.slow)("f", s.failures)
+              ("x", s.tripped ? ", stored as hex" : ""));
+      }
+   }
+
+   /**
+    *  abi_serializer decodes the data of an action right after resolving its
+    *  contract and drops the resolved abi when done, so the lifetime of each
+    *  resolved_abi is the time of one decode. abi_serializer catches a failed
+    *  decode and stores the data as hex without hex_data, which is how failures
+    *  are found in the result afterwards.
+    */
    template<typename T>
    fc::variant to_variant_with_abi( const T& obj ) {
+      return to_variant_with_abi( obj, [this]( const account_name& n ) { return get_abi_serializer( n ); } );
+   }
+
+   /// @param resolve returns the decoded abi of a contract, null to leave its data as hex
+   template<typename T, typename Resolve>
+   fc::variant to_variant_with_abi( const T& obj, const Resolve& resolve ) {
       fc::variant pretty_output;
+      resolved_contracts resolved;
       abi_serializer::to_variant( obj, pretty_output,
-                                  [&]( account_name n ) { return get_abi_serializer( n ); },
+                                  [&]( account_name n ) {
+                                     if( tripped( n ) ) return resolved_abi();
+                                     std::shared_ptr<const abi_serializer> abis = resolve( n );
+                                     if( !abis ) return resolved_abi();
+                                     add_resolved( resolved, n, abis );
+                                     return resolved_abi( std::move(abis), std::make_shared<timed_decode>( *this, n ) );
+                                  },
                                   abi_serializer_max_time );
+      if( !resolved.empty() ) record_hex_fallbacks( pretty_output, resolved );
       return pretty_output;
    }
 
+   /// @return the row decoded with the abi of code, null if code has no abi or table is not in it
+   fc::variant table_row_to_variant( const account_name &code, const eosio::chain::table_name &table, const eosio::chain::bytes& value ) {
+      fc::variant row;
+      if( tripped( code ) ) return row;
+      auto abis = get_decoded( code, true );
+      if( abis ) {
+         const auto start = fc::time_point::now();
+         bool failed = true;
+         try {
+            auto type = abis->get_table_type( table );
+            if( !type.empty() )
+               row = abis->binary_to_variant( type, value, abi_serializer_max_time );
+            failed = false;
+         } FC_CAPTURE_AND_LOG((code)(table))
+         record_decode( code, fc::time_point::now() - start, failed );
+      }
+      return row;
+   }
+
+   /// @return the serializer of the packed abi of name, as the abi database would decode it, null if it has none
+   std::shared_ptr<const abi_serializer> decode_abi( const account_name &name, const eosio::chain::bytes& packed_abi ) {
+      abi_def abi;
+      bool found = false;
+      try {
+         found = abi_serializer::to_abi( packed_abi, abi );
+      } FC_CAPTURE_AND_LOG((name))
+      if( !found ) return nullptr;
+      auto decoded = abi_def_to_serializer( name, abi );
+      if( !decoded ) return nullptr;
+      return std::make_shared<const abi_serializer>( std::move( *decoded ) );
+   }
+
    void upsert_abi_cache( const account_name &name, const abi_def& abi ) {
       if( name.good()) {
          try {
+            std::lock_guard<std::mutex> guard(mtx);
+            // a decode started before this upsert must not put the old abi back into the cache
+            ++abi_version;
+            auto itr = cache.find( name.value );
+            if( itr != cache.end() ) {
+               lru.erase( itr->second.position );
+               cache.erase( itr );
+            }
+
+            {
+               // the new abi gets a clean record
+               std::lock_guard<std::mutex> stats_guard(stats_mtx);
+               decode_stats.erase( name.value );
+            }
+
             auto* a = db.find<abi_cache, by_account>(name);
             if ( a == nullptr ) {
                db.create<abi_cache>( [&]( abi_cache& ca ) {
@@ -83,9 +260,195 @@ public:
    }
 
 private:
+   struct cached_abi {
+      std::shared_ptr<const abi_serializer> abis;
+      std::list<uint64_t>::iterator position; ///< in lru
+   };
+
+   /// charges the time from its creation to its destruction to a decode of account
+   class timed_decode {
+   public:
+      timed_decode( serializer& s, const account_name& account ):
+         s(s), account(account), started(fc::time_point::now()), uncaught(std::uncaught_exceptions()) {}
+      /// a decode left by an exception failed
+      ~timed_decode() {
+         try {
+            s.record_decode( account, fc::time_point::now() - started, std::uncaught_exceptions() > uncaught );
+         } catch( ... ) {}
+      }
+
+   private:
+      serializer& s;
+      account_name account;
+      fc::time_point started;
+      int uncaught;
+   };
+
+   /// the contracts resolved during one to_variant_with_abi, with their account names as stored in the result
+   using resolved_contracts = std::vector<std::tuple<account_name, std::string, std::shared_ptr<const abi_serializer>>>;
+
+   static void add_resolved( resolved_contracts& resolved, const account_name& n, const std::shared_ptr<const abi_serializer>& abis ) {
+      for( const auto& r : resolved ) {
+         if( std::get<0>( r ) == n ) return;
+      }
+      resolved.emplace_back( n, n.to_string(), abis );
+   }
+
+   /// records a failure for each action of v left as hex although the abi of its contract declares the action
+   void record_hex_fallbacks( const fc::variant& v, const resolved_contracts& resolved ) {
+      if( v.is_array() ) {
+         for( const auto& e : v.get_array() ) record_hex_fallbacks( e, resolved );
+         return;
+      }
+      if( !v.is_object() ) return;
+
+      const auto& o = v.get_object();
+      auto account = o.find( "account" );
+      auto name = o.find( "name" );
+      const bool is_action = account != o.end() && name != o.end() && o.find( "data" ) != o.end() &&
+                             account->value().is_string() && name->value().is_string();
+      if( is_action && o.find( "hex_data" ) == o.end() ) {
+         for( const auto& r : resolved ) {
+            if( std::get<1>( r ) != account->value().get_string() ) continue;
+            try {
+               if( !std::get<2>( r )->get_action_type( chain::action_name( name->value().get_string() ) ).empty() ) {
+                  record_failure( std::get<0>( r ) );
+               }
+            } catch( ... ) {} // not an action name, so not an action either
+            break;
+         }
+      }
+      for( const auto& e : o ) {
+         // the decoded data holds no actions, the actions of a trace are in its own members
+         if( is_action && (e.key() == "data" || e.key() == "hex_data") ) continue;
+         record_hex_fallbacks( e.value(), resolved );
+      }
+   }
+
+   static const size_t saved_usage_entries = 4096;
 
    chainbase::database db;
    fc::microseconds abi_serializer_max_time;
+   bfs::path usage_file;
+   const size_t cache_size;
+
+   std::unordered_map<uint64_t, cached_abi> cache;
+   std::list<uint64_t> lru; ///< cached accounts, most recently used first
+   std::unordered_map<uint64_t, uint64_t> uses; ///< lookups by account, including the previous runs
+   uint64_t abi_version = 0; ///< incremented by every upsert
+   std::mutex mtx; ///< guards db and the cache
+
+   fc::microseconds slow_decode_time = fc::microseconds::maximum();
+   uint32_t max_slow_decodes = 0;
+   std::unordered_map<uint64_t, abi_decode_stats> decode_stats;
+   std::mutex stats_mtx; ///< guards the decode stats and circuit breaker settings
+
+   bool tripped( const account_name &name ) {
+      std::lock_guard<std::mutex> guard(stats_mtx);
+      auto itr = decode_stats.find( name.value );
+      return itr != decode_stats.end() && itr->second.tripped;
+   }
+
+   void record_decode( const account_name &name, fc::microseconds elapsed, bool failed ) {
+      std::lock_guard<std::mutex> guard(stats_mtx);
+      auto& stats = decode_stats[name.value];
+      const uint64_t us = std::max<int64_t>( elapsed.count(), 0 );
+      ++stats.decodes;
+      stats.total_us += us;
+      stats.max_us = std::max( stats.max_us, us );
+      if( failed ) {
+         ++stats.failures;
+      } else if( elapsed >= slow_decode_time ) {
+         ++stats.slow;
+      } else {
+         return;
+      }
+      trip_locked( name, stats );
+   }
+
+   /// a decode already recorded by record_decode turned out to have failed
+   void record_failure( const account_name &name ) {
+      std::lock_guard<std::mutex> guard(stats_mtx);
+      auto& stats = decode_stats[name.value];
+      ++stats.failures;
+      trip_locked( name, stats );
+   }
+
+   void trip_locked( const account_name &name, abi_decode_stats& stats ) {
+      if( !stats.tripped && max_slow_decodes > 0 && stats.slow + stats.failures >= max_slow_decodes ) {
+         stats.tripped = true;
+         wlog("abi of ${a} was slow or failed ${n} times, its data is stored as hex until it sets a new abi",
+              ("a", name)("n", stats.slow + stats.failures));
+      }
+   }
+
+   /// @return the decoded abi of name, null if name has no abi
+   std::shared_ptr<const abi_serializer> get_decoded( const account_name &name, bool count_use ) {
+      if( !name.good() ) return nullptr;
+
+      abi_def abi;
+      uint64_t version = 0;
+      {
+         std::lock_guard<std::mutex> guard(mtx);
+         if( count_use ) ++uses[name.value];
+         auto itr = cache.find( name.value );
+         if( itr != cache.end() ) {
+            lru.splice( lru.begin(), lru, itr->second.position );
+            return itr->second.abis;
+         }
+
+         bool found = false;
+         try {
+            const auto* a = db.find<abi_cache, by_account>(name);
+            found = a != nullptr && abi_serializer::to_abi( a->abi, abi );
+         } FC_CAPTURE_AND_LOG((name))
+         if( !found ) return nullptr;
+         version = abi_version;
+      }
+
+      // built outside the lock, it is the expensive part
+      const auto start = fc::time_point::now();
+      auto decoded = abi_def_to_serializer( name, abi );
+      if( !decoded ) {
+         // an abi that cannot be loaded would otherwise be parsed again for every action
+         record_decode( name, fc::time_point::now() - start, true );
+         return nullptr;
+      }
+      auto abis = std::make_shared<const abi_serializer>( std::move( *decoded ) );
+
+      std::lock_guard<std::mutex> guard(mtx);
+      if( version == abi_version && cache.find( name.value ) == cache.end() ) {
+         lru.push_front( name.value );
+         cache.emplace( name.value, cached_abi{ abis, lru.begin() } );
+         while( cache.size() > cache_size ) {
+            cache.erase( lru.back() );
+            lru.pop_back();
+         }
+      }
+      return abis;
+   }
+
+   void load_usage() {
+      std::ifstream in( usage_file.string() );
+      uint64_t account = 0, count = 0;
+      while( in >> account >> count ) {
+         uses[account] += count;
+      }
+   }
+
+   void save_usage() {
+      std::vector<std::pair<uint64_t, uint64_t>> ranked( uses.begin(), uses.end() );
+      std::sort( ranked.begin(), ranked.end(), []( const auto& a, const auto& b ) { return a.second > b.second; } );
+      if( ranked.size() > saved_usage_entries ) ranked.resize( saved_usage_entries );
+
+      std::ofstream out( usage_file.string(), std::ios::trunc );
+      for( const auto& r : ranked ) {
+         out << r.first << ' ' << r.second << '\n';
+      }
+      if( !out ) {
+         wlog("unable to save abi usage to ${f}", ("f", usage_file.string()));
+      }
+   }
 
    optional<abi_serializer> abi_def_to_serializer( const account_name &name, const abi_def& abi ) {
       if( name.good()) {
@@ -0,0 +1,60 @@
+#include <eosio/chain/contract_table_objects.hpp>
+
+#include "table_deltas.hpp"
+
+namespace eosio {
+
+block_table_deltas_ptr capture_table_deltas( const chainbase::database& db, const chain::block_state_ptr& bs,
+                                             const std::set<chain::account_name>& contracts ) {
+   const auto& rows = db.get_index<chain::key_value_index>();
+   const auto& tables = db.get_index<chain::table_id_multi_index>();
+
+   if( rows.stack().empty() || rows.stack().back().revision != static_cast<int64_t>(bs->block_num) ) {
+      return block_table_deltas_ptr();
+   }
+
+   const auto& rows_undo = rows.stack().back();
+
+   // a table removed by the block together with its last row is only in the undo session
+   auto find_table = [&]( chain::table_id t_id ) -> const chain::table_id_object* {
+      if( auto* t = tables.find( t_id ) ) return t;
+      if( tables.stack().empty() ) return nullptr;
+      const auto& tables_undo = tables.stack().back();
+      auto itr = tables_undo.removed_values.find( t_id );
+      return itr != tables_undo.removed_values.end() ? &itr->second : nullptr;
+   };
+
+   auto deltas = std::make_shared<block_table_deltas>();
+   deltas->block_id = bs->id;
+   deltas->block_num = bs->block_num;
+   deltas->block_time = bs->block->timestamp;
+
+   auto add = [&]( const chain::key_value_object& row, bool present ) {
+      const auto* table = find_table( row.t_id );
+      if( !table || !contracts.count( table->code ) ) return;
+
+      table_row_delta delta;
+      delta.code = table->code;
+      delta.scope = table->scope;
+      delta.table = table->table;
+      delta.primary_key = row.primary_key;
+      delta.payer = row.payer;
+      delta.present = present;
+      delta.value.assign( row.value.data(), row.value.data() + row.value.size() );
+      deltas->rows.emplace_back( std::move(delta) );
+   };
+
+   for( const auto& old : rows_undo.old_values ) {
+      add( rows.get( old.first ), true );
+   }
+   for( const auto& removed : rows_undo.removed_values ) {
+      add( removed.second, false );
+   }
+   for( const auto id : rows_undo.new_ids ) {
+      add( rows.get( id ), true );
+   }
+
+   return deltas;
+}
+
+}
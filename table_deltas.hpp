@@ -0,0 +1,43 @@
+#pragma once
+#include <memory>
+#include <set>
+#include <vector>
+
+#include <eosio/chain/block_state.hpp>
+#include <eosio/chain/types.hpp>
+
+#include <chainbase/chainbase.hpp>
+
+namespace eosio {
+
+/// a contract table row created, modified (present) or removed (!present) by a block
+struct table_row_delta {
+   chain::account_name   code;
+   chain::scope_name     scope;
+   chain::table_name     table;
+   uint64_t              primary_key = 0;
+   chain::account_name   payer;
+   bool                  present = true;
+   chain::bytes          value;
+};
+
+struct block_table_deltas {
+   chain::block_id_type               block_id;
+   uint32_t                           block_num = 0;
+   chain::block_timestamp_type        block_time;
+   std::vector<table_row_delta>       rows;
+};
+
+using block_table_deltas_ptr = std::shared_ptr<block_table_deltas>;
+
+/**
+ *  Collects the rows of the tables of contracts changed by bs from the undo
+ *  session of the block, which is still on top of the chainbase undo stack when
+ *  accepted_block is emitted. Must be called from the accepted_block signal.
+ *
+ *  @return nullptr if the block was applied without an undo session, e.g. replayed from blocks.log
+ */
+block_table_deltas_ptr capture_table_deltas( const chainbase::database& db, const chain::block_state_ptr& bs,
+                                             const std::set<chain::account_name>& contracts );
+
+}
@@ -0,0 +1,202 @@
+/**
+ *  The document JSON of json_writer has to be byte for byte what
+ *  fc::prune_invalid_utf8( fc::json::to_string() ) wrote before it, with every
+ *  scan the cpu can run.
+ */
+#define BOOST_TEST_MODULE elasticsearch_plugin
+#include <boost/test/included/unit_test.hpp>
+
+#include <limits>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fc/io/json.hpp>
+#include <fc/string.hpp>
+#include <fc/variant_object.hpp>
+
+#include "json_writer.hpp"
+
+using eosio::json_string_scan;
+
+namespace {
+
+std::string fc_json( const fc::variant& v ) {
+   return fc::prune_invalid_utf8( fc::json::to_string( v ) );
+}
+
+const char* scan_name( json_string_scan scan ) {
+   switch( scan ) {
+      case json_string_scan::avx2: return "avx2";
+      case json_string_scan::sse2: return "sse2";
+      default: return "scalar";
+   }
+}
+
+/// the scans the cpu supports, the fastest last
+std::vector<json_string_scan> scans() {
+   std::vector<json_string_scan> result{ json_string_scan::scalar };
+   auto supported = eosio::supported_json_string_scan();
+   if( supported != json_string_scan::scalar ) result.push_back( json_string_scan::sse2 );
+   if( supported == json_string_scan::avx2 ) result.push_back( json_string_scan::avx2 );
+   return result;
+}
+
+/// goes back to the scan chosen at startup when a test case ends
+struct scan_fixture {
+   ~scan_fixture() { eosio::force_json_string_scan( eosio::supported_json_string_scan() ); }
+};
+
+std::string hex( const std::string& s ) {
+   static const char digits[] = "0123456789abcdef";
+   std::string out;
+   for( unsigned char c : s ) {
+      out.push_back( digits[c >> 4] );
+      out.push_back( digits[c & 0xF] );
+   }
+   return out;
+}
+
+void check_document( const fc::variant& v, const std::string& what ) {
+   const auto expected = fc_json( v );
+   for( auto scan : scans() ) {
+      eosio::force_json_string_scan( scan );
+      const auto actual = eosio::to_json( v );
+      if( actual != expected ) {
+         BOOST_ERROR( scan_name( scan ) << " scan of " << what << ": " << hex( actual ) << " != " << hex( expected ) );
+      }
+   }
+}
+
+void check_string( const std::string& s ) {
+   check_document( fc::variant( s ), hex( s ) );
+}
+
+/// bytes that leave the plain ASCII path of the scan
+std::vector<std::string> special_pieces() {
+   std::vector<std::string> pieces;
+   for( int c = 0; c < 0x20; ++c ) {
+      pieces.emplace_back( 1, static_cast<char>(c) );
+   }
+   for( const char* p : {
+           "\x7f", "\"", "\\", "/", "\\\"", "\"\\",
+           // valid sequences, including the lowest and highest of every length
+           "\xc2\x80", "\xc3\xa9", "\xdf\xbf", "\xe0\xa0\x80", "\xe2\x82\xac", "\xed\x9f\xbf", "\xee\x80\x80", "\xef\xbf\xbf",
+           "\xf0\x90\x80\x80", "\xf0\x9f\x98\x80", "\xf4\x8f\xbf\xbf",
+           // stray continuation bytes and bytes that never occur
+           "\x80", "\xbf", "\xc0", "\xc1", "\xf5", "\xf8", "\xfe", "\xff",
+           // overlong encodings
+           "\xc0\xaf", "\xc1\xbf", "\xe0\x80\xaf", "\xe0\x9f\xbf", "\xf0\x80\x80\xaf", "\xf0\x8f\xbf\xbf",
+           // surrogates, alone and as a pair
+           "\xed\xa0\x80", "\xed\xaf\xbf", "\xed\xb0\x80", "\xed\xbf\xbf", "\xed\xa0\xbd\xed\xb8\x80",
+           // beyond U+10FFFF
+           "\xf4\x90\x80\x80", "\xf7\xbf\xbf\xbf",
+           // truncated sequences, followed by ASCII and by another sequence
+           "\xc3", "\xe2\x82", "\xf0\x9f\x98", "\xe2\x82" "a", "\xf0\x9f" "\xc3\xa9", "\xc3\xc3\xa9" } ) {
+      pieces.emplace_back( p );
+   }
+   return pieces;
+}
+
+}
+
+BOOST_FIXTURE_TEST_SUITE( json_writer_tests, scan_fixture )
+
+BOOST_AUTO_TEST_CASE( plain_strings ) {
+   check_string( "" );
+   for( size_t size = 1; size <= 100; ++size ) {
+      std::string s;
+      for( size_t i = 0; i < size; ++i ) {
+         s.push_back( static_cast<char>( 0x20 + (i * 7) % 0x5f ) );
+      }
+      // the generated characters include '"' and '\\', replace them to keep the string plain
+      for( auto& c : s ) {
+         if( c == '"' || c == '\\' ) c = 'x';
+      }
+      check_string( s );
+   }
+}
+
+BOOST_AUTO_TEST_CASE( special_characters ) {
+   std::string all;
+   for( const auto& piece : special_pieces() ) {
+      check_string( piece );
+      all += piece;
+   }
+   check_string( all );
+}
+
+BOOST_AUTO_TEST_CASE( block_boundaries ) {
+   // every piece at every offset of two 32 byte blocks, with ASCII after it ending in all positions of a block
+   for( const auto& piece : special_pieces() ) {
+      for( size_t before = 0; before <= 66; ++before ) {
+         for( size_t after : { 0, 1, 2, 3, 15, 16, 17, 31, 32, 33 } ) {
+            check_string( std::string( before, 'a' ) + piece + std::string( after, 'b' ) );
+         }
+      }
+   }
+}
+
+BOOST_AUTO_TEST_CASE( repeated_pieces ) {
+   // several specials within one block and in consecutive blocks
+   for( const auto& piece : special_pieces() ) {
+      for( size_t gap = 0; gap <= 33; ++gap ) {
+         std::string s;
+         for( int i = 0; i < 6; ++i ) {
+            s += piece;
+            s += std::string( gap, 'c' );
+         }
+         check_string( s );
+      }
+   }
+}
+
+BOOST_AUTO_TEST_CASE( random_strings ) {
+   const auto pieces = special_pieces();
+   std::mt19937 rng( 20190701 );
+   for( int n = 0; n < 5000; ++n ) {
+      const size_t size = rng() % 160;
+      std::string s;
+      while( s.size() < size ) {
+         const auto pick = rng() % 16;
+         if( pick < 10 ) {
+            s.push_back( static_cast<char>( 0x20 + rng() % 0x5f ) );
+         } else if( pick < 13 ) {
+            s += pieces[ rng() % pieces.size() ];
+         } else {
+            s.push_back( static_cast<char>( rng() % 256 ) );
+         }
+      }
+      check_string( s );
+   }
+}
+
+BOOST_AUTO_TEST_CASE( documents ) {
+   fc::mutable_variant_object nested;
+   nested( "memo", "tab\there \xe2\x82\xac \xc0\xaf" );
+   nested( "quote\"key\\", fc::variants{ fc::variant( "\x01\x1f" ), fc::variant(), fc::variant( true ), fc::variant( false ) } );
+
+   fc::mutable_variant_object doc;
+   doc( "small", int64_t(42) );
+   doc( "negative", int64_t(-42) );
+   doc( "large_negative", std::numeric_limits<int64_t>::min() );
+   doc( "uint32_max", uint64_t(0xffffffff) );
+   doc( "above_uint32", uint64_t(0x100000000) );
+   doc( "int_above_uint32", int64_t(0x100000000) );
+   doc( "uint64_max", std::numeric_limits<uint64_t>::max() );
+   doc( "double", 1.5 );
+   doc( "blob", fc::blob{ std::vector<char>{ 'a', '\0', '\xff' } } );
+   doc( "empty_object", fc::variant_object() );
+   doc( "empty_array", fc::variants() );
+   doc( "nested", nested );
+   doc( "\xed\xa0\x80key", "value" );
+
+   check_document( fc::variant( doc ), "document" );
+
+   const auto expected = fc_json( fc::variant( doc ) );
+   BOOST_CHECK_EQUAL( eosio::to_json( doc ), expected );
+   BOOST_CHECK_EQUAL( eosio::to_json( fc::variant_object( doc ) ), expected );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
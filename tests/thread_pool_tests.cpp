@@ -0,0 +1,160 @@
+/**
+ *  thread_pool runs every task once, lets idle workers take the tasks of busy
+ *  ones and runs ordered tasks only after everything enqueued before them.
+ */
+#include <boost/test/unit_test.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fc/exception/exception.hpp>
+
+#include "thread_pool.hpp"
+
+using eosio::inline_task;
+using eosio::thread_pool;
+
+namespace {
+
+/// set once, waited for with a timeout so a broken pool fails instead of hanging the test
+class latch
+{
+public:
+   void set() {
+      {
+         std::lock_guard<std::mutex> guard(mtx);
+         done = true;
+      }
+      cv.notify_all();
+   }
+
+   bool wait() {
+      std::unique_lock<std::mutex> lock(mtx);
+      return cv.wait_for( lock, std::chrono::seconds(10), [this]() { return done; } );
+   }
+
+private:
+   bool done = false;
+   std::mutex mtx;
+   std::condition_variable cv;
+};
+
+}
+
+BOOST_AUTO_TEST_SUITE( thread_pool_tests )
+
+BOOST_AUTO_TEST_CASE( inline_task_captures ) {
+   auto small = std::make_shared<int>( 1 );
+   std::array<char, 2 * inline_task::inline_size> padding{};
+   auto large = std::make_shared<int>( 2 );
+
+   int sum = 0;
+   inline_task a( [small, &sum]() { sum += *small; } );
+   inline_task b( [large, padding, &sum]() { sum += *large + padding[0]; } );
+   BOOST_CHECK_EQUAL( small.use_count(), 2 );
+   BOOST_CHECK_EQUAL( large.use_count(), 2 );
+
+   // moving hands over the captures, inline or on the heap, without copying them
+   inline_task c( std::move(a) );
+   inline_task d;
+   d = std::move(b);
+   BOOST_CHECK( !a );
+   BOOST_CHECK( !b );
+   BOOST_CHECK_EQUAL( small.use_count(), 2 );
+   BOOST_CHECK_EQUAL( large.use_count(), 2 );
+
+   c();
+   d();
+   BOOST_CHECK_EQUAL( sum, 3 );
+
+   c.reset();
+   d.reset();
+   BOOST_CHECK_EQUAL( small.use_count(), 1 );
+   BOOST_CHECK_EQUAL( large.use_count(), 1 );
+}
+
+BOOST_AUTO_TEST_CASE( every_task_runs_once ) {
+   const size_t tasks = 10000;
+   std::vector<std::atomic<int>> runs( tasks );
+   {
+      thread_pool pool( 4, 1024 * 1024 );
+      for( size_t i = 0; i < tasks; ++i ) {
+         pool.enqueue( 64, [&runs, i]() { ++runs[i]; } );
+      }
+      // the destructor runs the remaining tasks
+   }
+   for( size_t i = 0; i < tasks; ++i ) {
+      BOOST_REQUIRE_EQUAL( runs[i].load(), 1 );
+   }
+}
+
+BOOST_AUTO_TEST_CASE( idle_worker_steals ) {
+   latch third_ran;
+   bool waited = false;
+   {
+      thread_pool pool( 2, 1024 * 1024 );
+      // dealt to queues 0, 1 and 0: the first task holds a worker until the third has run,
+      // so either the third or the first was taken from the queue of another worker
+      pool.enqueue( 1, [&]() { waited = third_ran.wait(); } );
+      pool.enqueue( 1, []() {} );
+      pool.enqueue( 1, [&]() { third_ran.set(); } );
+      BOOST_CHECK( third_ran.wait() );
+      BOOST_CHECK_GE( pool.get_stats().steals, 1u );
+   }
+   BOOST_CHECK( waited );
+}
+
+BOOST_AUTO_TEST_CASE( ordered_tasks_run_after_earlier_tasks ) {
+   const int before = 200;
+   std::atomic<int> earlier_done{0};
+   std::atomic<int> later_done{0};
+   std::vector<int> seen_by_ordered;
+   std::mutex seen_mtx;
+   latch later_ran;
+   {
+      thread_pool pool( 4, 1024 * 1024 );
+      for( int i = 0; i < before; ++i ) {
+         pool.enqueue( 1, [&]() {
+            std::this_thread::sleep_for( std::chrono::microseconds(100) );
+            ++earlier_done;
+         } );
+      }
+      pool.enqueue_after( [&]() {
+         std::lock_guard<std::mutex> guard(seen_mtx);
+         seen_by_ordered.push_back( earlier_done.load() );
+      } );
+      pool.enqueue_after( [&]() {
+         std::lock_guard<std::mutex> guard(seen_mtx);
+         seen_by_ordered.push_back( -1 );
+      } );
+      // not held back by the ordered tasks before it
+      pool.enqueue( 1, [&]() { ++later_done; later_ran.set(); } );
+      BOOST_CHECK( later_ran.wait() );
+   }
+   BOOST_CHECK_EQUAL( later_done.load(), 1 );
+   BOOST_REQUIRE_EQUAL( seen_by_ordered.size(), 2u );
+   BOOST_CHECK_EQUAL( seen_by_ordered[0], before );
+   BOOST_CHECK_EQUAL( seen_by_ordered[1], -1 );
+}
+
+BOOST_AUTO_TEST_CASE( ordered_task_of_an_idle_pool_runs ) {
+   latch ran;
+   thread_pool pool( 1, 1024 * 1024 );
+   pool.enqueue_after( [&]() { ran.set(); } );
+   BOOST_CHECK( ran.wait() );
+}
+
+BOOST_AUTO_TEST_CASE( cpu_list ) {
+   BOOST_CHECK( (thread_pool::parse_cpu_list( "2-4, 7" ) == std::vector<int>{ 2, 3, 4, 7 }) );
+   BOOST_CHECK( thread_pool::parse_cpu_list( "" ).empty() );
+   BOOST_CHECK_THROW( thread_pool::parse_cpu_list( "4-2" ), fc::exception );
+   BOOST_CHECK_THROW( thread_pool::parse_cpu_list( "a" ), fc::exception );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
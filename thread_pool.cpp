@@ -0,0 +1,247 @@
+#include <cerrno>
+#include <chrono>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+
+#include <fc/exception/exception.hpp>
+#include <fc/log/logger.hpp>
+
+#include "thread_pool.hpp"
+#include "exceptions.hpp"
+
+namespace eosio {
+
+namespace {
+
+void pin_thread( std::thread& t, int cpu ) {
+#ifdef __linux__
+   cpu_set_t set;
+   CPU_ZERO( &set );
+   CPU_SET( cpu, &set );
+   int r = pthread_setaffinity_np( t.native_handle(), sizeof(set), &set );
+   if ( r != 0 ) {
+      wlog("unable to pin thread pool worker to cpu ${c}, error: ${r}", ("c", cpu)("r", r));
+   }
+#else
+   wlog("pinning thread pool workers is not supported on this platform, cpu ${c} ignored", ("c", cpu));
+#endif
+}
+
+}
+
+thread_pool::epoch::~epoch() {
+   if ( after ) {
+      // the ordered task belongs to the next epoch, so the ordered task closing that one runs after it
+      pool.push( queued_task{ std::move(after), 0, std::move(next) } );
+   }
+}
+
+thread_pool::thread_pool(size_t threads, size_t max_retained_bytes, const std::vector<int>& cpus):
+   max_retained_bytes(max_retained_bytes), current_epoch(std::make_shared<epoch>(*this))
+{
+   for ( size_t i = 0; i < threads; ++i ) {
+      queues.emplace_back( new worker_queue() );
+   }
+   for ( size_t i = 0; i < threads; ++i ) {
+      this->threads.emplace_back( [this, i]() { worker( i ); } );
+      if ( !cpus.empty() ) {
+         pin_thread( this->threads.back(), cpus[i % cpus.size()] );
+      }
+   }
+}
+
+thread_pool::~thread_pool() {
+   // the last ordered task is queued while the workers still run
+   std::atomic_store( &current_epoch, std::shared_ptr<epoch>() );
+   {
+      std::lock_guard<std::mutex> guard(mtx);
+      stopping = true;
+   }
+   task_cv.notify_all();
+   for ( auto& t : threads ) {
+      t.join();
+   }
+   ilog("thread pool stopped, peak retained task memory: ${b} bytes, steals: ${s}",
+        ("b", peak_retained_bytes.load())("s", steals.load()));
+}
+
+void thread_pool::reserve( size_t bytes ) {
+   auto admitted = [this, bytes]() {
+      auto current = retained_bytes.load();
+      while ( current == 0 || current + bytes <= max_retained_bytes ) {
+         if ( retained_bytes.compare_exchange_weak( current, current + bytes ) ) {
+            auto peak = peak_retained_bytes.load();
+            while ( current + bytes > peak && !peak_retained_bytes.compare_exchange_weak( peak, current + bytes ) ) {}
+            return true;
+         }
+      }
+      return false;
+   };
+   if ( admitted() ) return;
+
+   std::unique_lock<std::mutex> lock(mtx);
+   ++space_waiters;
+   if ( !space_cv.wait_for( lock, std::chrono::seconds(10), admitted ) ) {
+      wlog("waiting for thread pool, retained: ${r} bytes, tasks: ${t}", ("r", retained_bytes.load())("t", pending.load()));
+      space_cv.wait( lock, admitted );
+   }
+   --space_waiters;
+}
+
+void thread_pool::release( size_t bytes ) {
+   retained_bytes -= bytes;
+   if ( space_waiters ) {
+      // taking the lock orders the release before the waiter's next check
+      std::lock_guard<std::mutex> guard(mtx);
+      space_cv.notify_all();
+   }
+}
+
+void thread_pool::enqueue( size_t bytes, inline_task task ) {
+   reserve( bytes );
+   push( queued_task{ std::move(task), bytes, std::atomic_load( &current_epoch ) } );
+}
+
+void thread_pool::enqueue_after( inline_task task ) {
+   auto fresh = std::make_shared<epoch>( *this );
+   std::lock_guard<std::mutex> guard(epoch_mtx);
+   auto closed = std::atomic_load( &current_epoch );
+   closed->after = std::move( task );
+   closed->next = fresh;
+   std::atomic_store( &current_epoch, std::move(fresh) );
+   // task is queued by the release of closed here if none of the earlier tasks is left
+}
+
+void thread_pool::push( queued_task&& task ) {
+   // counted first so a worker taking it right away never sees pending drop below zero
+   ++pending;
+   auto& queue = *queues[next_queue++ % queues.size()];
+   {
+      std::lock_guard<std::mutex> guard(queue.mtx);
+      queue.tasks.push_back( std::move(task) );
+   }
+   if ( idle_workers ) {
+      std::lock_guard<std::mutex> guard(mtx);
+      task_cv.notify_one();
+   }
+}
+
+bool thread_pool::try_pop( size_t self, queued_task& task ) {
+   // own queue first, then the oldest task of the others, starting with the next one
+   for ( size_t i = 0; i < queues.size(); ++i ) {
+      auto& queue = *queues[(self + i) % queues.size()];
+      std::lock_guard<std::mutex> guard(queue.mtx);
+      if ( queue.tasks.empty() ) continue;
+      task = std::move( queue.tasks.front() );
+      queue.tasks.pop_front();
+      --pending;
+      if ( i != 0 ) ++steals;
+      return true;
+   }
+   return false;
+}
+
+thread_pool::stats thread_pool::get_stats() const {
+   stats s;
+   s.queued_tasks = pending;
+   s.retained_bytes = retained_bytes;
+   s.peak_retained_bytes = peak_retained_bytes;
+   s.steals = steals;
+   return s;
+}
+
+void thread_pool::worker( size_t self ) {
+   while ( true ) {
+      queued_task task;
+      if ( !try_pop( self, task ) ) {
+         std::unique_lock<std::mutex> lock(mtx);
+         ++idle_workers;
+         task_cv.wait( lock, [this]() { return pending > 0 || stopping; } );
+         --idle_workers;
+         if ( pending == 0 && stopping ) return;
+         continue;
+      }
+
+      try {
+         task.run();
+      } catch ( const fc::exception& e ) {
+         elog("thread pool task failed: ${e}", ("e", e.to_detail_string()));
+      } catch ( const std::exception& e ) {
+         elog("thread pool task failed: ${e}", ("e", e.what()));
+      } catch ( ... ) {
+         elog("thread pool task failed with unknown exception");
+      }
+      // the captures of the task are what is retained, drop them before giving back the bytes
+      task.run.reset();
+      release( task.bytes );
+      // may queue an ordered task, before this worker looks for work again
+      task.from.reset();
+   }
+}
+
+void thread_pool::keep_threads_off( const std::vector<int>& cpus ) {
+   if ( cpus.empty() ) return;
+#ifdef __linux__
+   cpu_set_t allowed;
+   CPU_ZERO( &allowed );
+   if ( sched_getaffinity( 0, sizeof(allowed), &allowed ) != 0 ) {
+      wlog("unable to read the cpu affinity of nodeos, its threads are not moved off the worker cpus");
+      return;
+   }
+   for ( int cpu : cpus ) {
+      if ( cpu < CPU_SETSIZE ) CPU_CLR( cpu, &allowed );
+   }
+   if ( CPU_COUNT( &allowed ) == 0 ) {
+      wlog("--elastic-worker-cpus covers every cpu nodeos may run on, its threads are not moved off them");
+      return;
+   }
+
+   // the main thread, the chain threads and any other thread started so far
+   size_t moved = 0;
+   boost::system::error_code ec;
+   for ( boost::filesystem::directory_iterator it( "/proc/self/task", ec ), end; !ec && it != end; it.increment( ec ) ) {
+      const auto tid = std::stoi( it->path().filename().string() );
+      if ( sched_setaffinity( tid, sizeof(allowed), &allowed ) == 0 ) {
+         ++moved;
+      } else {
+         wlog("unable to move thread ${t} off the worker cpus, error: ${e}", ("t", tid)("e", errno));
+      }
+   }
+   if ( ec ) {
+      wlog("unable to list the threads of nodeos: ${e}", ("e", ec.message()));
+   }
+   ilog("moved ${n} nodeos threads off the worker cpus", ("n", moved));
+#else
+   wlog("pinning thread pool workers is not supported on this platform, nodeos threads are not moved");
+#endif
+}
+
+std::vector<int> thread_pool::parse_cpu_list( const std::string& list ) {
+   std::vector<int> cpus;
+   std::vector<std::string> ranges;
+   boost::split( ranges, list, boost::is_any_of(",") );
+   for ( auto& range : ranges ) {
+      boost::trim( range );
+      if ( range.empty() ) continue;
+      try {
+         auto dash = range.find( '-' );
+         int first = std::stoi( range.substr( 0, dash ) );
+         int last = dash == std::string::npos ? first : std::stoi( range.substr( dash + 1 ) );
+         EOS_ASSERT( first >= 0 && first <= last, chain::plugin_config_exception, "invalid cpu range: ${r}", ("r", range) );
+         for ( int cpu = first; cpu <= last; ++cpu ) {
+            cpus.push_back( cpu );
+         }
+      } catch ( const std::logic_error& ) {
+         EOS_THROW( chain::plugin_config_exception, "invalid cpu list: ${l}", ("l", list) );
+      }
+   }
+   return cpus;
+}
+
+}
@@ -0,0 +1,218 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace eosio {
+
+/**
+ *  Move-only callable for thread pool tasks. Captures up to inline_size bytes are
+ *  stored in the object itself, larger ones on the heap, so the usual document
+ *  task does not allocate the way a std::function holding it would.
+ */
+class inline_task
+{
+public:
+   static constexpr size_t inline_size = 128;
+
+   inline_task() = default;
+
+   template<typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, inline_task>::value>::type>
+   inline_task( F&& f ) {
+      using T = typename std::decay<F>::type;
+      using fits = std::integral_constant<bool, sizeof(T) <= inline_size && alignof(T) <= alignof(std::max_align_t) &&
+                                                std::is_nothrow_move_constructible<T>::value>;
+      construct<T>( std::forward<F>(f), fits() );
+   }
+
+   inline_task( inline_task&& other ) noexcept { take( other ); }
+
+   inline_task& operator=( inline_task&& other ) noexcept {
+      if ( this != &other ) {
+         reset();
+         take( other );
+      }
+      return *this;
+   }
+
+   ~inline_task() { reset(); }
+
+   void operator()() { ops->invoke( &storage ); }
+
+   explicit operator bool() const { return ops != nullptr; }
+
+   /// destroys the captures
+   void reset() {
+      if ( ops ) {
+         ops->destroy( &storage );
+         ops = nullptr;
+      }
+   }
+
+private:
+   struct operations {
+      void (*invoke)( void* );
+      void (*move)( void* from, void* to );
+      void (*destroy)( void* );
+   };
+
+   template<typename T, bool Inline>
+   struct stored {
+      static T& get( void* p ) { return Inline ? *static_cast<T*>(p) : **static_cast<T**>(p); }
+      static void invoke( void* p ) { get( p )(); }
+      static void move( void* from, void* to ) {
+         if ( Inline ) {
+            new (to) T( std::move( get( from ) ) );
+            get( from ).~T();
+         } else {
+            *static_cast<T**>(to) = *static_cast<T**>(from);
+         }
+      }
+      static void destroy( void* p ) {
+         if ( Inline ) get( p ).~T();
+         else delete *static_cast<T**>(p);
+      }
+      static const operations table;
+   };
+
+   template<typename T, typename F>
+   void construct( F&& f, std::true_type ) {
+      new (&storage) T( std::forward<F>(f) );
+      ops = &stored<T, true>::table;
+   }
+
+   template<typename T, typename F>
+   void construct( F&& f, std::false_type ) {
+      *reinterpret_cast<T**>(&storage) = new T( std::forward<F>(f) );
+      ops = &stored<T, false>::table;
+   }
+
+   void take( inline_task& other ) {
+      ops = other.ops;
+      if ( ops ) {
+         ops->move( &other.storage, &storage );
+         other.ops = nullptr;
+      }
+   }
+
+   typename std::aligned_storage<inline_size, alignof(std::max_align_t)>::type storage;
+   const operations* ops = nullptr;
+};
+
+template<typename T, bool Inline>
+const inline_task::operations inline_task::stored<T, Inline>::table = { &invoke, &move, &destroy };
+
+/**
+ *  Work-stealing pool of threads serializing documents. Every worker has its
+ *  own queue that tasks are dealt to in turn; a worker out of work takes the
+ *  oldest task of another queue, so there is no single lock every enqueue and
+ *  every pop contend on. Workers can be pinned to a set of cpus, and the other
+ *  threads of nodeos moved off them with keep_threads_off, so serialization and
+ *  block application do not share cores.
+ *
+ *  Every task is enqueued with the approximate bytes it retains, i.e. the
+ *  traces and blocks it captured, which are held until the task has run.
+ *  enqueue blocks while the retained bytes are above the ceiling, so a burst
+ *  of large transactions waits in the chain instead of piling up in the pool.
+ */
+class thread_pool
+{
+public:
+   struct stats {
+      size_t queued_tasks = 0;
+      size_t retained_bytes = 0;
+      size_t peak_retained_bytes = 0;
+      uint64_t steals = 0;
+   };
+
+   /// @param cpus worker i is pinned to cpus[i % cpus.size()], not pinned if empty
+   thread_pool(size_t threads, size_t max_retained_bytes, const std::vector<int>& cpus = std::vector<int>());
+   /// runs the remaining tasks before the threads are joined
+   ~thread_pool();
+
+   /// blocks until bytes fit under the ceiling; an idle pool admits a task of any size
+   void enqueue( size_t bytes, inline_task task );
+
+   /**
+    *  Runs task once every task enqueued before the call has run, without waiting
+    *  for that. Ordered tasks run in the order they were enqueued in, tasks
+    *  enqueued after one are not held back by it. Retains nothing, so it never
+    *  blocks either.
+    */
+   void enqueue_after( inline_task task );
+
+   stats get_stats() const;
+
+   /// @return the cpus of a list like "2-5,8"
+   static std::vector<int> parse_cpu_list( const std::string& list );
+
+   /**
+    *  Restricts every thread of the process to the cpus it may run on except cpus.
+    *  Threads created afterwards inherit the restriction from their creator, so
+    *  called before the pool is created only the workers run on cpus.
+    */
+   static void keep_threads_off( const std::vector<int>& cpus );
+
+private:
+   /**
+    *  The tasks enqueued between two ordered tasks. Each task holds its epoch and
+    *  every epoch holds the next one, so an epoch is destroyed, and the ordered
+    *  task closing it is queued, only once the tasks of all earlier epochs have run.
+    */
+   struct epoch {
+      explicit epoch(thread_pool& pool): pool(pool) {}
+      ~epoch();
+
+      thread_pool& pool;
+      inline_task after;           ///< the ordered task that closed this epoch, if any
+      std::shared_ptr<epoch> next;
+   };
+
+   struct queued_task {
+      inline_task run;
+      size_t bytes = 0;
+      std::shared_ptr<epoch> from;
+   };
+
+   struct worker_queue {
+      std::mutex mtx;
+      std::deque<queued_task> tasks;
+   };
+
+   void push( queued_task&& task );
+   bool try_pop( size_t self, queued_task& task );
+   void worker( size_t self );
+   void reserve( size_t bytes );
+   void release( size_t bytes );
+
+   const size_t max_retained_bytes;
+   std::vector<std::unique_ptr<worker_queue>> queues;
+   std::vector<std::thread> threads;
+
+   std::atomic<size_t> next_queue{0};
+   std::atomic<size_t> pending{0};       ///< enqueued tasks no worker has taken yet
+   std::atomic<size_t> idle_workers{0};
+   std::atomic<size_t> retained_bytes{0};
+   std::atomic<size_t> peak_retained_bytes{0};
+   std::atomic<size_t> space_waiters{0};
+   std::atomic<uint64_t> steals{0};
+   std::atomic<bool> stopping{false};
+
+   std::shared_ptr<epoch> current_epoch; ///< read and replaced with the atomic shared_ptr functions
+   std::mutex epoch_mtx; ///< orders the ordered tasks of concurrent callers
+
+   std::mutex mtx; ///< only for sleeping, tasks are never queued under it
+   std::condition_variable task_cv;
+   std::condition_variable space_cv;
+};
+
+}